@@ -35,16 +35,55 @@
   "realloc2-bal.rep"
 
 /*
- * This constant gives the estimated performance of the libc malloc
- * package using our traces on some reference system, typically the
- * same kind of system the students use. Its purpose is to cap the
- * contribution of throughput to the performance index. Once the
- * students surpass the AVG_LIBC_THRUPUT, they get no further benefit
- * to their score.  This deters students from building extremely fast,
- * but extremely stupid malloc packages.
+ * The large suite (mdriver --suite=large): traces of 1M to 50M
+ * requests that gentrace generates into LARGE_TRACEDIR with "make
+ * large-traces" (the recipes are in traces/Makefile). Each trace
+ * comes with a utilization reference in <trace>.util (see gentrace
+ * -u), which the driver reports mm's utilization against. It also
+ * times libc malloc on each trace on this host, reports mm's
+ * throughput against it, and caps each trace's throughput score at
+ * libc's on that trace.
+ *
+ * These traces are streamed from disk (as with -s) and need a bigger
+ * heap than MAX_HEAP, so LARGE_MAX_HEAP is the default for them.
+ */
+#define LARGE_TRACEDIR "./traces/large/"
+
+#define LARGE_TRACEFILES \
+  "server-churn.bin",\
+  "compiler-phases.bin",\
+  "prodcons-queue.bin",\
+  "string-vector-growth.bin",\
+  "large-buffer-mix.bin"
+
+#define LARGE_MAX_HEAP (512*(1<<20))  /* 512 MB */
+
+/*
+ * The contribution of throughput to the performance index is capped
+ * at the throughput of the libc malloc package on the same traces.
+ * Once the students surpass it, they get no further benefit to their
+ * score.  This deters students from building extremely fast, but
+ * extremely stupid malloc packages. The driver times libc on the
+ * host it runs on; this constant, an estimate for some reference
+ * system, is the cap only when it can't (with -s, whose traces are
+ * never loaded whole).
  */
 #define AVG_LIBC_THRUPUT      600E3  /* 600 Kops/sec */
 
+/*
+ * Shared objects of other allocators that mdriver -l runs the traces
+ * through, next to libc malloc, if the dynamic linker finds them.
+ * More can be named with --allocator.
+ */
+#define SYSTEM_ALLOCATORS \
+  "libjemalloc.so.2",\
+  "libtcmalloc_minimal.so.4",\
+  "libtcmalloc.so.4",\
+  "libmimalloc.so.2",\
+  "libhoard.so"
+
+#define MAX_ALLOCATORS 16  /* most allocators -l compares, libc included */
+
  /* 
   * This constant determines the contributions of space utilization
   * (UTIL_WEIGHT) and throughput (1 - UTIL_WEIGHT) to the performance
@@ -58,15 +97,88 @@
 #define ALIGNMENT 8  
 
 /* 
- * Maximum heap size in bytes 
+ * Default maximum heap size in bytes. You can override it at runtime
+ * with the -m flag.
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
+/*
+ * Advice that memlib gives the OS for pages the allocator releases with
+ * mem_release(). MADV_DONTNEED drops them at once, so the resident page
+ * counts reported by the driver reflect the release. MADV_FREE is
+ * cheaper, but the kernel only reclaims such pages under memory pressure.
+ */
+#define RELEASE_ADVICE MADV_DONTNEED
+
+/*
+ * The driver reports the peak of the heap's resident memory over a
+ * trace's util run. It counts the resident pages whenever the heap
+ * grows and every RESIDENT_EVERY requests in between.
+ */
+#define RESIDENT_EVERY 4096
+
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
 #define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
-#define USE_GETTOD 1   /* gettimeofday (any Unix box) */
+#define USE_GETTOD 0   /* gettimeofday (any Unix box) */
+#define USE_CLOCK  1   /* clock_gettime, repeated until the CI is tight */
+
+/*
+ * Parameters for USE_CLOCK. After FTIMER_WARMUP untimed runs, the
+ * function is timed one run at a time until the 95% confidence
+ * interval of the mean is within FTIMER_CI_TARGET of the mean, or
+ * until FTIMER_MAX_RUNS runs or FTIMER_MAX_SECS seconds.
+ */
+#define FTIMER_WARMUP     2
+#define FTIMER_MIN_RUNS   5
+#define FTIMER_MAX_RUNS   1000
+#define FTIMER_MAX_SECS   2.0
+#define FTIMER_CI_TARGET  0.01
+
+/*
+ * Cold runs (--cold, --startup) first evict the heap and the trace
+ * from the caches by reading COLD_CACHE_BYTES of another buffer, one
+ * COLD_CACHE_LINE at a time. It should be well over the size of the
+ * last level cache.
+ */
+#define COLD_CACHE_BYTES  (64*(1<<20))  /* 64 MB */
+#define COLD_CACHE_LINE   64
+
+/*
+ * mdriver --startup times mm_init and the first requests of each
+ * trace this many times, cold, and reports the medians
+ */
+#define STARTUP_RUNS      21
+
+/*
+ * mdriver --touch=F stands in for the program around the allocator:
+ * it writes every payload when it is allocated and, between requests,
+ * touches a fraction F of the live blocks, reading or writing one
+ * byte in each TOUCH_LINE of their first TOUCH_BYTES. It reports the
+ * fastest of TOUCH_RUNS runs.
+ */
+#define TOUCH_BYTES       256
+#define TOUCH_LINE        64
+#define TOUCH_RUNS        5
+
+/*
+ * mdriver --locality counts the LOCALITY_PAGE pages and LOCALITY_LINE
+ * lines the live blocks span, and the pages the requests touch in
+ * each window of LOCALITY_WINDOW requests
+ */
+#define LOCALITY_PAGE     4096
+#define LOCALITY_LINE     64
+#define LOCALITY_WINDOW   1000
+
+/*
+ * When comparing two packages (--baseline), the candidate regresses
+ * on a trace if it fails where the baseline passes, if its utilization is more than
+ * AB_UTIL_TOL below the baseline's, or if its throughput is lower by
+ * more than the fraction AB_THRU_TOL with 95% confidence.
+ */
+#define AB_UTIL_TOL       0.005
+#define AB_THRU_TOL       0.02
 
 #endif /* __CONFIG_H */
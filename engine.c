@@ -0,0 +1,153 @@
+/*
+ * engine.c - the malloc package a driver evaluates (see engine.h)
+ */
+#define _GNU_SOURCE     /* for RTLD_DEEPBIND and RTLD_DEFAULT */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+
+#include "engine.h"
+#include "memlib.h"
+
+/* The package the driver was linked with */
+static engine_t builtin = {
+    "mm.c", NULL, &team, 0,
+    mm_init, mm_malloc, mm_free, mm_realloc,
+    mem_init, mem_set_backing, mem_set_limit, mem_reset_brk, mem_reset_heap,
+    mem_heap_lo, mem_heap_hi, mem_heapsize, mem_resident_pages,
+    ""
+};
+
+/*
+ * engine_builtin - return the package the driver was linked with
+ */
+engine_t *engine_builtin(void)
+{
+    builtin.thread_safe = mm_thread_safe;
+    return &builtin;
+}
+
+/*
+ * engine_load - load the package in the shared object at path into
+ *    *e. The shared object must define everything in mm.h and the
+ *    memlib functions in engine_t; mm_thread_safe is optional. Returns
+ *    0 on success, or -1 with the reason in e->errmsg.
+ */
+int engine_load(char *path, engine_t *e)
+{
+    int *thread_safe;
+
+    memset(e, 0, sizeof(*e));
+    e->name = path;
+    if ((e->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+	snprintf(e->errmsg, sizeof(e->errmsg), "%s", dlerror());
+	return -1;
+    }
+
+#define ENGINE_SYM(field, sym)						\
+    if ((*(void **)&e->field = dlsym(e->handle, sym)) == NULL) {	\
+	snprintf(e->errmsg, sizeof(e->errmsg), "%.200s does not define %s", \
+		 path, sym);						\
+	engine_unload(e);						\
+	return -1;							\
+    }
+    ENGINE_SYM(team, "team");
+    ENGINE_SYM(mm_init, "mm_init");
+    ENGINE_SYM(mm_malloc, "mm_malloc");
+    ENGINE_SYM(mm_free, "mm_free");
+    ENGINE_SYM(mm_realloc, "mm_realloc");
+    ENGINE_SYM(mem_init, "mem_init");
+    ENGINE_SYM(mem_set_backing, "mem_set_backing");
+    ENGINE_SYM(mem_set_limit, "mem_set_limit");
+    ENGINE_SYM(mem_reset_brk, "mem_reset_brk");
+    ENGINE_SYM(mem_reset_heap, "mem_reset_heap");
+    ENGINE_SYM(mem_heap_lo, "mem_heap_lo");
+    ENGINE_SYM(mem_heap_hi, "mem_heap_hi");
+    ENGINE_SYM(mem_heapsize, "mem_heapsize");
+    ENGINE_SYM(mem_resident_pages, "mem_resident_pages");
+#undef ENGINE_SYM
+
+    if ((thread_safe = dlsym(e->handle, "mm_thread_safe")) != NULL)
+	e->thread_safe = *thread_safe;
+    return 0;
+}
+
+/*
+ * engine_start - set up the package's simulated heap, with the given
+ *    memlib backing and size limit unless they are NULL or 0
+ */
+void engine_start(engine_t *e, char *backing, size_t limit)
+{
+    if (backing)
+	e->mem_set_backing(backing);
+    if (limit)
+	e->mem_set_limit(limit);
+    e->mem_init();
+}
+
+/*
+ * engine_unload - unload a package loaded by engine_load
+ */
+void engine_unload(engine_t *e)
+{
+    if (e->handle)
+	dlclose(e->handle);
+    e->handle = NULL;
+}
+
+/* The malloc the driver was linked with */
+static sysalloc_t libc = {
+    "libc", NULL, malloc, free, realloc, ""
+};
+
+/*
+ * sysalloc_libc - return the malloc the driver was linked with
+ */
+sysalloc_t *sysalloc_libc(void)
+{
+    return &libc;
+}
+
+/*
+ * sysalloc_load - load the malloc, free and realloc of the shared
+ *    object at path into *a. RTLD_DEEPBIND makes the object's own
+ *    calls to them stay inside it, instead of binding to libc's as
+ *    they would in the global scope. Returns 0 on success, or -1 with
+ *    the reason in a->errmsg.
+ */
+int sysalloc_load(char *path, sysalloc_t *a)
+{
+    memset(a, 0, sizeof(*a));
+    a->name = path;
+    if ((a->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL | RTLD_DEEPBIND)) == NULL) {
+	snprintf(a->errmsg, sizeof(a->errmsg), "%s", dlerror());
+	return -1;
+    }
+
+    /* A symbol the object lacks is found in its libc dependency instead */
+#define SYSALLOC_SYM(field, sym)						\
+    if ((*(void **)&a->field = dlsym(a->handle, sym)) == NULL ||		\
+	*(void **)&a->field == dlsym(RTLD_DEFAULT, sym)) {			\
+	snprintf(a->errmsg, sizeof(a->errmsg), "%.200s does not define %s", \
+		 path, sym);							\
+	sysalloc_unload(a);						\
+	return -1;							\
+    }
+    SYSALLOC_SYM(malloc, "malloc");
+    SYSALLOC_SYM(free, "free");
+    SYSALLOC_SYM(realloc, "realloc");
+#undef SYSALLOC_SYM
+
+    return 0;
+}
+
+/*
+ * sysalloc_unload - unload a malloc loaded by sysalloc_load
+ */
+void sysalloc_unload(sysalloc_t *a)
+{
+    if (a->handle)
+	dlclose(a->handle);
+    a->handle = NULL;
+}
@@ -0,0 +1,66 @@
+/*
+ * engine.h - the malloc package a driver evaluates
+ *
+ * An engine is an mm.c together with the memlib.c its heap comes
+ * from, reached through function pointers so that the driver can
+ * evaluate packages other than the one it was linked with. Those are
+ * loaded from shared objects built like mm.so (see the Makefile),
+ * each with its own memlib and so its own simulated heap.
+ *
+ * A sysalloc is an ordinary malloc, free and realloc, such as libc's
+ * or one loaded from a jemalloc or tcmalloc shared object, that the
+ * driver runs the traces through for comparison. It has no simulated
+ * heap, so only its correctness and throughput are measured.
+ */
+#ifndef __ENGINE_H_
+#define __ENGINE_H_
+
+#include <stddef.h>
+
+#include "mm.h"
+
+typedef struct {
+    char *name;              /* the shared object's path, or "mm.c" */
+    void *handle;            /* from dlopen, or NULL if built in */
+    team_t *team;            /* the package's team structure */
+    int thread_safe;         /* was it built with -DMM_THREAD_SAFE? */
+
+    /* the package... */
+    int (*mm_init)(void);
+    void *(*mm_malloc)(size_t size);
+    void (*mm_free)(void *ptr);
+    void *(*mm_realloc)(void *ptr, size_t size);
+
+    /* ... and the memlib it allocates from */
+    void (*mem_init)(void);
+    int (*mem_set_backing)(char *spec);
+    void (*mem_set_limit)(size_t bytes);
+    void (*mem_reset_brk)(void);
+    void (*mem_reset_heap)(void);
+    void *(*mem_heap_lo)(void);
+    void *(*mem_heap_hi)(void);
+    size_t (*mem_heapsize)(void);
+    size_t (*mem_resident_pages)(void);
+
+    char errmsg[256];        /* why engine_load failed */
+} engine_t;
+
+engine_t *engine_builtin(void);
+int engine_load(char *path, engine_t *e);
+void engine_start(engine_t *e, char *backing, size_t limit);
+void engine_unload(engine_t *e);
+
+typedef struct {
+    char *name;              /* the shared object's path, or "libc" */
+    void *handle;            /* from dlopen, or NULL for libc */
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    char errmsg[256];        /* why sysalloc_load failed */
+} sysalloc_t;
+
+sysalloc_t *sysalloc_libc(void);
+int sysalloc_load(char *path, sysalloc_t *a);
+void sysalloc_unload(sysalloc_t *a);
+
+#endif /* __ENGINE_H_ */
@@ -13,6 +13,10 @@ typedef void (*test_funct)(void *);
 /* Compute number of cycles used by test function f */
 double fcyc(test_funct f, void* argp);
 
+/* Run the code that clears the cache once, as fcyc does before each
+   measurement when set_fcyc_clear_cache is set */
+void fcyc_clear_cache(void);
+
 /*********************************************************
  * Set the various parameters used by measurement routines 
  *********************************************************/
@@ -36,6 +36,10 @@ void init_fsecs(void)
 #elif USE_GETTOD
     if (verbose)
 	printf("Measuring performance with gettimeofday().\n");
+#elif USE_CLOCK
+    if (verbose)
+	printf("Measuring performance with clock_gettime() to a %.0f%% CI.\n",
+	       FTIMER_CI_TARGET * 100);
 #endif
 }
 
@@ -44,6 +48,19 @@ void init_fsecs(void)
  */
 double fsecs(fsecs_test_funct f, void *argp) 
 {
+    return fsecs_ci(f, argp, NULL);
+}
+
+/*
+ * fsecs_ci - Return the running time of a function f (in seconds),
+ *    and in *halfwidth (if not NULL) the half-width of the 95% 
+ *    confidence interval of that time, or 0 if the timing method
+ *    doesn't estimate one
+ */
+double fsecs_ci(fsecs_test_funct f, void *argp, double *halfwidth) 
+{
+    if (halfwidth)
+	*halfwidth = 0;
 #if USE_FCYC
     double cycles = fcyc(f, argp);
     return cycles/(Mhz*1e6);
@@ -51,7 +68,72 @@ double fsecs(fsecs_test_funct f, void *argp)
     return ftimer_itimer(f, argp, 10);
 #elif USE_GETTOD
     return ftimer_gettod(f, argp, 10);
+#elif USE_CLOCK
+    return ftimer_clock(f, argp, halfwidth);
 #endif 
 }
 
+/*
+ * fsecs_less - Like fsecs_ci, but return the running time of f less
+ *    that of null, a function that does the part of f's work that
+ *    isn't to be counted. Where the timing method estimates a CI, the
+ *    runs of f and null are paired and *halfwidth is the CI of their
+ *    difference, not of f alone.
+ */
+double fsecs_less(fsecs_test_funct f, fsecs_test_funct null, void *argp,
+		  double *halfwidth)
+{
+#if USE_CLOCK
+    return ftimer_clock_less(f, null, argp, halfwidth);
+#else
+    return fsecs_ci(f, argp, halfwidth) - fsecs(null, argp);
+#endif
+}
 
+/*
+ * set_fsecs_cold - From now on, flush the caches before each timed
+ *    run, so that every run starts cold instead of where the last one
+ *    left off. Returns -1 if the timing method runs f back to back
+ *    and so can't, else 0.
+ */
+int set_fsecs_cold(void)
+{
+    set_fcyc_cache_size(COLD_CACHE_BYTES);
+    set_fcyc_cache_block(COLD_CACHE_LINE);
+#if USE_FCYC
+    set_fcyc_clear_cache(1); /* already set, but for a smaller cache */
+    return 0;
+#elif USE_CLOCK
+    set_ftimer_clear_cache(1);
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+/*
+ * fsecs_clear_cache - Flush the caches once, as set_fsecs_cold does
+ *    before each timed run
+ */
+void fsecs_clear_cache(void)
+{
+    set_fcyc_cache_size(COLD_CACHE_BYTES);
+    set_fcyc_cache_block(COLD_CACHE_LINE);
+    fcyc_clear_cache();
+}
+
+/*
+ * fsecs_method - Return a short name for the timing method in use
+ */
+char *fsecs_method(void)
+{
+#if USE_FCYC
+    return "fcyc";
+#elif USE_ITIMER
+    return "itimer";
+#elif USE_GETTOD
+    return "gettimeofday";
+#elif USE_CLOCK
+    return "clock_gettime";
+#endif 
+}
@@ -2,3 +2,9 @@ typedef void (*fsecs_test_funct)(void *);
 
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+double fsecs_ci(fsecs_test_funct f, void *argp, double *halfwidth);
+double fsecs_less(fsecs_test_funct f, fsecs_test_funct null, void *argp,
+		  double *halfwidth);
+char *fsecs_method(void);
+int set_fsecs_cold(void);
+void fsecs_clear_cache(void);
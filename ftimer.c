@@ -7,10 +7,32 @@
  * Function timers that estimate the running time (in seconds) of a function f.
  *    ftimer_itimer: version that uses the interval timer
  *    ftimer_gettod: version that uses gettimeofday
+ *    ftimer_clock:  version that uses clock_gettime and repeats until
+ *                   the mean is known to within a target CI
+ *    ftimer_clock_less: same, for the time f takes beyond a null
+ *                   function that does part of its work
+ *    ftimer_once:   version that uses clock_gettime for a single run
+ *
+ * ftimer_clock and ftimer_once can clear the cache before each run
+ * (set_ftimer_clear_cache), so that every run starts cold.
  */
 #include <stdio.h>
+#include <math.h>
+#include <time.h>
 #include <sys/time.h>
 #include "ftimer.h"
+#include "fcyc.h"
+#include "config.h"
+
+/* Not subject to NTP slewing where the system has it */
+#ifdef CLOCK_MONOTONIC_RAW
+#define FTIMER_CLOCK CLOCK_MONOTONIC_RAW
+#else
+#define FTIMER_CLOCK CLOCK_MONOTONIC
+#endif
+
+/* Clear the cache before each run? (set_ftimer_clear_cache) */
+static int clear_cache = 0;
 
 /* function prototypes */
 static void init_etime(void);
@@ -52,6 +74,116 @@ double ftimer_gettod(ftimer_test_funct f, void *argp, int n)
     return (1E-3*diff);
 }
 
+/*
+ * ftimer_clock - Use clock_gettime to estimate the running time of
+ * f(argp). After a few warmup runs, time one run at a time until
+ * the 95% confidence interval of the mean is narrow enough. Return
+ * the mean, and the CI half-width in *halfwidth if it isn't NULL.
+ */
+double ftimer_clock(ftimer_test_funct f, void *argp, double *halfwidth)
+{
+    return ftimer_clock_less(f, NULL, argp, halfwidth);
+}
+
+/*
+ * ftimer_clock_less - Like ftimer_clock, but each sample is the time
+ * of a run of f(argp) less the time of a run of null(argp) right
+ * after it, so the mean and its CI are those of the difference. A
+ * NULL null is taken to cost nothing.
+ */
+double ftimer_clock_less(ftimer_test_funct f, ftimer_test_funct null,
+			 void *argp, double *halfwidth)
+{
+    struct timespec first, start, end;
+    double t, delta, mean = 0, m2 = 0, hw = 0;
+    int i, n;
+
+    for (i = 0; i < FTIMER_WARMUP; i++) {
+	f(argp);
+	if (null)
+	    null(argp);
+    }
+
+    clock_gettime(FTIMER_CLOCK, &first);
+    for (n = 1; n <= FTIMER_MAX_RUNS; n++) {
+	if (clear_cache)
+	    fcyc_clear_cache();
+	clock_gettime(FTIMER_CLOCK, &start);
+	f(argp);
+	clock_gettime(FTIMER_CLOCK, &end);
+	t = (end.tv_sec - start.tv_sec) + 1E-9*(end.tv_nsec - start.tv_nsec);
+	if (null) {
+	    if (clear_cache)
+		fcyc_clear_cache();
+	    clock_gettime(FTIMER_CLOCK, &start);
+	    null(argp);
+	    clock_gettime(FTIMER_CLOCK, &end);
+	    t -= (end.tv_sec - start.tv_sec) + 
+		1E-9*(end.tv_nsec - start.tv_nsec);
+	}
+
+	/* Welford's running mean and sum of squared deviations */
+	delta = t - mean;
+	mean += delta / n;
+	m2 += delta * (t - mean);
+
+	if (n >= FTIMER_MIN_RUNS) {
+	    hw = ftimer_tcrit(n - 1) * sqrt(m2 / (n - 1) / n);
+	    if (hw <= FTIMER_CI_TARGET * mean ||
+		(end.tv_sec - first.tv_sec) + 
+		1E-9*(end.tv_nsec - first.tv_nsec) >= FTIMER_MAX_SECS)
+		break;
+	}
+    }
+    if (halfwidth)
+	*halfwidth = hw;
+    return mean;
+}
+
+/*
+ * ftimer_once - Use clock_gettime to time a single run of f(argp), for
+ * callers that interleave runs of several functions themselves
+ */
+double ftimer_once(ftimer_test_funct f, void *argp)
+{
+    struct timespec start, end;
+
+    if (clear_cache)
+	fcyc_clear_cache();
+    clock_gettime(FTIMER_CLOCK, &start);
+    f(argp);
+    clock_gettime(FTIMER_CLOCK, &end);
+    return (end.tv_sec - start.tv_sec) + 1E-9*(end.tv_nsec - start.tv_nsec);
+}
+
+/*
+ * set_ftimer_clear_cache - When set, clear the cache before each run
+ * that ftimer_clock or ftimer_once times
+ */
+void set_ftimer_clear_cache(int clear)
+{
+    clear_cache = clear;
+}
+
+/*
+ * ftimer_tcrit - Return the two-sided 95% critical value of Student's
+ * t distribution with df degrees of freedom
+ */
+double ftimer_tcrit(int df)
+{
+    static double t95[] = {
+	12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+	2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+	2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+
+    if (df < 1)
+	return t95[0];
+    if (df <= 30)
+	return t95[df - 1];
+    return 1.960 + 2.4 / df; /* within 0.002 of the exact value */
+}
+
 
 /*
  * Routines for manipulating the Unix interval timer
@@ -12,3 +12,26 @@ double ftimer_itimer(ftimer_test_funct f, void *argp, int n);
    Return the average of n runs */
 double ftimer_gettod(ftimer_test_funct f, void *argp, int n);
 
+/* Estimate the running time of f(argp) using clock_gettime, timing
+   runs until the confidence interval is tight enough (see config.h).
+   Return the mean, and the half-width of its 95% CI in *halfwidth */
+double ftimer_clock(ftimer_test_funct f, void *argp, double *halfwidth);
+
+/* Like ftimer_clock, but time f(argp) less null(argp), pairing a run
+   of each per sample so the CI is that of the difference */
+double ftimer_clock_less(ftimer_test_funct f, ftimer_test_funct null,
+			 void *argp, double *halfwidth);
+
+/* Return the running time of a single run of f(argp), using
+   clock_gettime */
+double ftimer_once(ftimer_test_funct f, void *argp);
+
+/* Return the two-sided 95% critical value of Student's t with df
+   degrees of freedom */
+double ftimer_tcrit(int df);
+
+/* When set, ftimer_clock and ftimer_once clear the cache (with
+   fcyc_clear_cache) before each run they time, outside the timing.
+   Default = 0 */
+void set_ftimer_clear_cache(int clear);
+
@@ -0,0 +1,802 @@
+/*
+ * gentrace.c - generate synthetic malloc lab traces
+ *
+ * Writes a trace of any length, from millions of ops up, that depends
+ * only on the seed and the phase descriptions, so the same command
+ * always gives the same trace:
+ *
+ *     unix> gentrace -s 7 -p n=2000000,size=lognormal:48:1.2,life=exp:5000 big.rep
+ *
+ * A trace is a sequence of phases, each given with -p as a list of
+ * key=value pairs separated by commas:
+ *
+ *     n=<count>        allocation requests (a or r) in the phase
+ *     size=<dist>      size of each new block in bytes
+ *     life=<dist>      how long each new block lives, counted in
+ *                      allocation requests
+ *     realloc=<p>      probability that a request reallocates a live
+ *                      block instead of allocating a new one
+ *     grow=<how>       new size of a reallocated block: add:<bytes>,
+ *                      mul:<factor>, or "size" to draw it from size=
+ *     max=<bytes>      largest size to request
+ *     end=free         free every live block when the phase ends
+ *                      (the default, end=keep, lets them live on)
+ *
+ * Keys left out keep their value from the phase before (the first
+ * phase starts from the defaults below). A distribution is one of
+ *
+ *     fixed:<v>              always v
+ *     uniform:<lo>:<hi>      uniform on [lo, hi]
+ *     lognormal:<med>:<sig>  median med, log standard deviation sig
+ *     exp:<mean>             exponential
+ *     zipf:<max>:<s>         k times the quantum (8 bytes for sizes, 1
+ *                            request for lifetimes), for k up to max
+ *                            over the quantum, with P(k) ~ 1/k^s
+ *     empirical:<file>       from a file of "<value> <weight>" lines
+ *     forever                (life only) freed when the trace ends
+ *
+ * Blocks are freed in order of their death, and whatever is still
+ * live at the end is freed then, so the trace is balanced. gentrace
+ * reads the trace back and checks it as checktrace.pl does before it
+ * reports success. With -c it checks an existing trace instead.
+ *
+ * With -u it also writes <tracefile>.util, the space utilization that
+ * a boundary-tag allocator (REF_ALIGN-aligned blocks with REF_TAGS
+ * bytes of header and footer, at least REF_MIN bytes each) would reach
+ * on the trace with no fragmentation at all. It depends only on the
+ * trace, and mdriver --suite=large reports mm's utilization against it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "tracefile.h"
+
+/* Phase defaults */
+#define DEF_N       100000
+#define DEF_SIZE    "lognormal:64:1.0"
+#define DEF_LIFE    "exp:1000"
+#define DEF_GROW    "mul:1.5"
+#define DEF_MAX     (1 << 20)
+
+/* The reference allocator of -u */
+#define REF_ALIGN   8
+#define REF_TAGS    8
+#define REF_MIN     16
+
+#define SIZE_QUANTUM 8          /* zipf step for sizes */
+#define MAX_ZIPF     (1 << 22)  /* most ranks in a zipf table */
+#define MAX_PHASES   64
+#define MAXLINE      1024
+
+/* A probability distribution over positive values */
+typedef struct {
+    enum {FIXED, UNIFORM, LOGNORMAL, EXPONENTIAL, ZIPF, EMPIRICAL,
+	  FOREVER} kind;
+    double a, b;             /* parameters, by kind */
+    int n;                   /* ZIPF, EMPIRICAL: table of n values... */
+    double *cdf;             /* ... with their cumulative probabilities */
+    double *val;
+} dist_t;
+
+/* One phase of the workload */
+typedef struct {
+    long n;                  /* allocation requests */
+    dist_t size;
+    dist_t life;
+    double realloc;          /* chance a request is a realloc */
+    enum {GROW_ADD, GROW_MUL, GROW_SIZE} grow;
+    double growby;
+    unsigned long long max;  /* largest request size */
+    int drain;               /* free all live blocks at the end */
+} phase_t;
+
+/* Pending death of a live block */
+typedef struct {
+    unsigned long when;
+    long id;
+} death_t;
+
+/* Generator state, rebuilt for each pass over the phases */
+typedef struct {
+    unsigned long long rng;  /* splitmix64 state */
+    unsigned long now;       /* allocation requests made so far */
+    long next_id;
+    death_t *heap;           /* min-heap of deaths... */
+    long nheap;
+    long *live;              /* ... all live ids, in no order ... */
+    long nlive;
+    long *pos;               /* ... each id's slot in live, or -1 ... */
+    unsigned long long *size; /* ... and its size */
+    long long live_bytes, peak_bytes;
+    long long ref_bytes, peak_ref; /* the same in reference blocks (-u) */
+    long ops;
+
+    FILE *fp;                /* text output, or */
+    tracebin_writer_t *bin;  /* binary output, or neither to just count */
+    int error;
+} gen_t;
+
+static void usage(void);
+static void app_error(char *msg);
+
+/*****************************
+ * Random numbers and sampling
+ *****************************/
+
+/*
+ * rand_next - splitmix64: a fast generator whose whole state is the seed
+ */
+static unsigned long long rand_next(gen_t *g)
+{
+    unsigned long long z = (g->rng += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/*
+ * rand_unit - uniform on (0, 1), never 0 so its log is finite
+ */
+static double rand_unit(gen_t *g)
+{
+    return ((rand_next(g) >> 11) + 0.5) / 9007199254740992.0;
+}
+
+/*
+ * rand_normal - standard normal, by Box-Muller
+ */
+static double rand_normal(gen_t *g)
+{
+    double u = rand_unit(g), v = rand_unit(g);
+
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+/*
+ * sample - draw a value from d. Returns -1 for FOREVER.
+ */
+static double sample(gen_t *g, dist_t *d)
+{
+    double u;
+    int lo, hi, mid;
+
+    switch (d->kind) {
+    case FIXED:
+	return d->a;
+    case UNIFORM:
+	return d->a + (double)(rand_next(g) % (unsigned long long)(d->b - d->a + 1));
+    case LOGNORMAL:
+	return d->a * exp(d->b * rand_normal(g));
+    case EXPONENTIAL:
+	return -d->a * log(rand_unit(g));
+    case ZIPF:
+    case EMPIRICAL:
+	/* The first entry whose cumulative probability reaches u */
+	u = rand_unit(g) * d->cdf[d->n - 1];
+	for (lo = 0, hi = d->n - 1; lo < hi; ) {
+	    mid = (lo + hi) / 2;
+	    if (d->cdf[mid] < u)
+		lo = mid + 1;
+	    else
+		hi = mid;
+	}
+	return d->val[lo];
+    case FOREVER:
+	break;
+    }
+    return -1;
+}
+
+/******************************
+ * Parsing the phase descriptions
+ ******************************/
+
+/*
+ * load_empirical - read the table of an empirical distribution
+ */
+static void load_empirical(dist_t *d, char *path)
+{
+    FILE *fp;
+    char line[MAXLINE], msg[MAXLINE];
+    double v, w, sum = 0;
+    int cap = 0;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+	sprintf(msg, "Could not open %.900s", path);
+	app_error(msg);
+    }
+    d->n = 0;
+    while (fgets(line, sizeof(line), fp)) {
+	if (line[0] == '#' || sscanf(line, "%lf %lf", &v, &w) != 2)
+	    continue;
+	if (v < 0 || w < 0) {
+	    sprintf(msg, "Negative value or weight in %.900s", path);
+	    app_error(msg);
+	}
+	if (d->n == cap) {
+	    cap = cap ? 2 * cap : 256;
+	    d->cdf = realloc(d->cdf, cap * sizeof(double));
+	    d->val = realloc(d->val, cap * sizeof(double));
+	    if (d->cdf == NULL || d->val == NULL)
+		app_error("Out of memory for an empirical distribution");
+	}
+	sum += w;
+	d->val[d->n] = v;
+	d->cdf[d->n++] = sum;
+    }
+    fclose(fp);
+    if (d->n == 0 || sum <= 0) {
+	sprintf(msg, "No \"<value> <weight>\" lines in %.900s", path);
+	app_error(msg);
+    }
+}
+
+/*
+ * parse_dist - parse a distribution for a key of a phase. quantum is
+ *    the step between zipf values.
+ */
+static void parse_dist(dist_t *d, char *key, char *spec, double quantum)
+{
+    char msg[MAXLINE];
+    double sum = 0;
+    int k;
+
+    memset(d, 0, sizeof(*d));
+    if (sscanf(spec, "fixed:%lf", &d->a) == 1 && d->a >= 0)
+	d->kind = FIXED;
+    else if (sscanf(spec, "uniform:%lf:%lf", &d->a, &d->b) == 2 &&
+	     d->a >= 0 && d->b >= d->a)
+	d->kind = UNIFORM;
+    else if (sscanf(spec, "lognormal:%lf:%lf", &d->a, &d->b) == 2 &&
+	     d->a > 0 && d->b >= 0)
+	d->kind = LOGNORMAL;
+    else if (sscanf(spec, "exp:%lf", &d->a) == 1 && d->a > 0)
+	d->kind = EXPONENTIAL;
+    else if (sscanf(spec, "zipf:%lf:%lf", &d->a, &d->b) == 2 &&
+	     d->a >= quantum && d->a / quantum <= MAX_ZIPF && d->b >= 0) {
+	d->kind = ZIPF;
+	d->n = (int)(d->a / quantum);
+	d->cdf = malloc(d->n * sizeof(double));
+	d->val = malloc(d->n * sizeof(double));
+	if (d->cdf == NULL || d->val == NULL)
+	    app_error("Out of memory for a zipf distribution");
+	for (k = 1; k <= d->n; k++) {
+	    sum += pow(k, -d->b);
+	    d->val[k - 1] = k * quantum;
+	    d->cdf[k - 1] = sum;
+	}
+    }
+    else if (!strncmp(spec, "empirical:", 10) && spec[10]) {
+	d->kind = EMPIRICAL;
+	load_empirical(d, spec + 10);
+    }
+    else if (!strcmp(spec, "forever") && !strcmp(key, "life"))
+	d->kind = FOREVER;
+    else {
+	sprintf(msg, "Bogus %s distribution: %.900s", key, spec);
+	app_error(msg);
+    }
+}
+
+/*
+ * parse_phase - fill in p from a -p description, on top of what it
+ *    already holds
+ */
+static void parse_phase(phase_t *p, char *desc)
+{
+    char *spec = strdup(desc), *item, *val, *end, *save;
+    char msg[MAXLINE];
+
+    if (spec == NULL)
+	app_error("Out of memory");
+    for (item = strtok_r(spec, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+	if ((val = strchr(item, '=')) == NULL)
+	    goto bogus;
+	*val++ = '\0';
+	errno = 0;
+	if (!strcmp(item, "n")) {
+	    p->n = strtol(val, &end, 10);
+	    if (*end || errno || p->n < 0)
+		goto bogus;
+	}
+	else if (!strcmp(item, "size"))
+	    parse_dist(&p->size, item, val, SIZE_QUANTUM);
+	else if (!strcmp(item, "life"))
+	    parse_dist(&p->life, item, val, 1);
+	else if (!strcmp(item, "realloc")) {
+	    p->realloc = strtod(val, &end);
+	    if (*end || p->realloc < 0 || p->realloc > 1)
+		goto bogus;
+	}
+	else if (!strcmp(item, "grow")) {
+	    if (sscanf(val, "add:%lf", &p->growby) == 1)
+		p->grow = GROW_ADD;
+	    else if (sscanf(val, "mul:%lf", &p->growby) == 1 && p->growby > 0)
+		p->grow = GROW_MUL;
+	    else if (!strcmp(val, "size"))
+		p->grow = GROW_SIZE;
+	    else
+		goto bogus;
+	}
+	else if (!strcmp(item, "max")) {
+	    p->max = strtoull(val, &end, 10);
+	    if (*end || errno || val[0] == '-' || p->max < 1 ||
+		p->max > LLONG_MAX)
+		goto bogus;
+	}
+	else if (!strcmp(item, "end")) {
+	    if (!strcmp(val, "free"))
+		p->drain = 1;
+	    else if (!strcmp(val, "keep"))
+		p->drain = 0;
+	    else
+		goto bogus;
+	}
+	else
+	    goto bogus;
+    }
+    free(spec);
+    return;
+
+ bogus:
+    sprintf(msg, "Bogus phase item \"%.400s\" in %.400s", item, desc);
+    app_error(msg);
+}
+
+/********************
+ * Writing the trace
+ ********************/
+
+/*
+ * emit - write one request, or just count it on the counting pass
+ */
+static void emit(gen_t *g, int type, long id, unsigned long long size)
+{
+    traceop_t op;
+
+    g->ops++;
+    if (g->fp) {
+	if (type == FREE)
+	    fprintf(g->fp, "f %ld\n", id);
+	else
+	    fprintf(g->fp, "%c %ld %llu\n", (type == ALLOC) ? 'a' : 'r',
+		    id, size);
+    }
+    else if (g->bin) {
+	op.type = type;
+	op.index = id;
+	op.size = size;
+	op.tid = 0;
+	if (tracebin_put(g->bin, &op) < 0)
+	    g->error = 1;
+    }
+}
+
+/*
+ * heap_push, heap_pop - the min-heap of pending deaths
+ */
+static void heap_push(gen_t *g, unsigned long when, long id)
+{
+    long i = g->nheap++, parent;
+
+    while (i > 0 && g->heap[parent = (i - 1) / 2].when > when) {
+	g->heap[i] = g->heap[parent];
+	i = parent;
+    }
+    g->heap[i].when = when;
+    g->heap[i].id = id;
+}
+
+static long heap_pop(gen_t *g)
+{
+    long id = g->heap[0].id;
+    death_t last = g->heap[--g->nheap];
+    long i = 0, child;
+
+    while ((child = 2 * i + 1) < g->nheap) {
+	if (child + 1 < g->nheap && g->heap[child + 1].when < g->heap[child].when)
+	    child++;
+	if (g->heap[child].when >= last.when)
+	    break;
+	g->heap[i] = g->heap[child];
+	i = child;
+    }
+    g->heap[i] = last;
+    return id;
+}
+
+/*
+ * ref_block - the bytes the reference allocator of -u takes for a
+ *    block of size bytes
+ */
+static long long ref_block(unsigned long long size)
+{
+    unsigned long long bytes = (size + REF_TAGS + REF_ALIGN - 1) & 
+	~(unsigned long long)(REF_ALIGN - 1);
+
+    return (bytes < REF_MIN) ? REF_MIN : (long long)bytes;
+}
+
+/*
+ * free_block - free a live block
+ */
+static void free_block(gen_t *g, long id)
+{
+    long slot = g->pos[id];
+
+    g->live[slot] = g->live[--g->nlive];
+    g->pos[g->live[slot]] = slot;
+    g->pos[id] = -1;
+    g->live_bytes -= g->size[id];
+    g->ref_bytes -= ref_block(g->size[id]);
+    emit(g, FREE, id, 0);
+}
+
+/*
+ * clamp - round a drawn size to a request size in [1, max]
+ */
+static unsigned long long clamp(double v, unsigned long long max)
+{
+    if (!(v >= 1))           /* also catches NaN */
+	return 1;
+    return (v >= max) ? max : (unsigned long long)(v + 0.5);
+}
+
+/*
+ * run_phase - generate one phase
+ */
+static void run_phase(gen_t *g, phase_t *p)
+{
+    long i, id;
+    unsigned long long size;
+    double life;
+
+    for (i = 0; i < p->n; i++) {
+	g->now++;
+	while (g->nheap > 0 && g->heap[0].when <= g->now)
+	    free_block(g, heap_pop(g));
+
+	if (g->nlive > 0 && p->realloc > 0 && rand_unit(g) < p->realloc) {
+	    id = g->live[rand_next(g) % g->nlive];
+	    if (p->grow == GROW_ADD)
+		size = clamp(g->size[id] + p->growby, p->max);
+	    else if (p->grow == GROW_MUL)
+		size = clamp(g->size[id] * p->growby, p->max);
+	    else
+		size = clamp(sample(g, &p->size), p->max);
+	    g->live_bytes += (long long)size - (long long)g->size[id];
+	    g->ref_bytes += ref_block(size) - ref_block(g->size[id]);
+	    g->size[id] = size;
+	    emit(g, REALLOC, id, size);
+	}
+	else {
+	    id = g->next_id++;
+	    size = clamp(sample(g, &p->size), p->max);
+	    g->pos[id] = g->nlive;
+	    g->live[g->nlive++] = id;
+	    g->size[id] = size;
+	    g->live_bytes += size;
+	    g->ref_bytes += ref_block(size);
+	    emit(g, ALLOC, id, size);
+	    if ((life = sample(g, &p->life)) >= 0)
+		heap_push(g, g->now + ((life < 1) ? 1 :
+				       (life > 1e15) ? (unsigned long)1e15 :
+				       (unsigned long)life), id);
+	}
+	if (g->live_bytes > g->peak_bytes)
+	    g->peak_bytes = g->live_bytes;
+	if (g->ref_bytes > g->peak_ref)
+	    g->peak_ref = g->ref_bytes;
+    }
+
+    if (p->drain) {
+	while (g->nheap > 0)
+	    heap_pop(g);
+	while (g->nlive > 0)
+	    free_block(g, g->live[g->nlive - 1]);
+    }
+}
+
+/*
+ * generate - make one pass over all phases from the seed, then free
+ *    what is still live: deaths first in order, then the immortals
+ */
+static void generate(gen_t *g, phase_t *phases, int nphases,
+		     unsigned long long seed, long max_ids)
+{
+    long i;
+
+    g->rng = seed;
+    g->now = 0;
+    g->next_id = 0;
+    g->nheap = g->nlive = 0;
+    g->live_bytes = g->peak_bytes = 0;
+    g->ref_bytes = g->peak_ref = 0;
+    g->ops = 0;
+    for (i = 0; i < max_ids; i++)
+	g->pos[i] = -1;
+
+    for (i = 0; i < nphases; i++)
+	run_phase(g, &phases[i]);
+    while (g->nheap > 0)
+	free_block(g, heap_pop(g));
+    while (g->nlive > 0)
+	free_block(g, g->live[g->nlive - 1]);
+}
+
+/*****************
+ * Checking traces
+ *****************/
+
+/*
+ * check_trace - read back the trace at path and check, as checktrace.pl
+ *    does, that every free and realloc names a live block, that no id
+ *    is allocated twice, and that every block is freed. Also checks
+ *    the header counts. Returns 0 if all is well, else -1 with a
+ *    message in errmsg.
+ */
+static int check_trace(char *path, char *errmsg)
+{
+    tracefile_t tf;
+    traceop_t op;
+    unsigned char *state;    /* per id: 0 unused, 1 live, 2 freed */
+    uint64_t ops = 0, ids = 0, live = 0;
+    int rc;
+
+    if (tracefile_open(path, &tf) < 0) {
+	strcpy(errmsg, tf.errmsg);
+	return -1;
+    }
+    if (tf.num_ids >= SIZE_MAX ||
+	(state = calloc((size_t)tf.num_ids + 1, 1)) == NULL) {
+	sprintf(errmsg, "Too many ids (%llu) to check",
+		(unsigned long long)tf.num_ids);
+	tracefile_close(&tf);
+	return -1;
+    }
+
+    while ((rc = tracefile_next(&tf, &op)) > 0) {
+	ops++;
+	if (op.type == BARRIER)
+	    continue;
+	if (op.index >= tf.num_ids) {
+	    sprintf(errmsg, "Request %llu: id %llu out of range",
+		    (unsigned long long)ops, (unsigned long long)op.index);
+	    goto bad;
+	}
+	switch (op.type) {
+	case ALLOC:
+	    if (state[op.index]) {
+		sprintf(errmsg, "Request %llu: %s", (unsigned long long)ops,
+			(state[op.index] == 1) ?
+			"allocate with no intervening free" : "reused ID");
+		goto bad;
+	    }
+	    state[op.index] = 1;
+	    ids++;
+	    live++;
+	    break;
+	case REALLOC:
+	    if (state[op.index] != 1) {
+		sprintf(errmsg, "Request %llu: realloc without previous alloc",
+			(unsigned long long)ops);
+		goto bad;
+	    }
+	    break;
+	case FREE:
+	    if (state[op.index] != 1) {
+		sprintf(errmsg, "Request %llu: %s", (unsigned long long)ops,
+			(state[op.index] == 0) ?
+			"freeing unallocated block" : "freeing already freed block");
+		goto bad;
+	    }
+	    state[op.index] = 2;
+	    live--;
+	    break;
+	default:
+	    break;
+	}
+    }
+    if (rc < 0) {
+	strcpy(errmsg, tf.errmsg);
+	goto bad;
+    }
+    if (ops != tf.num_ops || ids != tf.num_ids) {
+	sprintf(errmsg, "Header says %llu ids and %llu ops, found %llu and %llu",
+		(unsigned long long)tf.num_ids, (unsigned long long)tf.num_ops,
+		(unsigned long long)ids, (unsigned long long)ops);
+	goto bad;
+    }
+    if (live > 0) {
+	sprintf(errmsg, "Unbalanced trace: %llu blocks are never freed",
+		(unsigned long long)live);
+	goto bad;
+    }
+    free(state);
+    tracefile_close(&tf);
+    return 0;
+
+ bad:
+    free(state);
+    tracefile_close(&tf);
+    return -1;
+}
+
+/**************
+ * Main routine
+ **************/
+int main(int argc, char **argv)
+{
+    int c, i;
+    char *path;
+    char errmsg[MAXLINE];
+    unsigned long long seed = 1; /* set by -s */
+    int binary = 0;              /* write a binary trace (-b) */
+    int check_only = 0;          /* just check the trace (-c) */
+    int write_util = 0;          /* also write <tracefile>.util (-u) */
+    char utilpath[MAXLINE];
+    FILE *fp;
+    phase_t phases[MAX_PHASES];
+    int nphases = 0;
+    phase_t cur;                 /* the phase being described */
+    long max_ids = 0;
+    tracebin_writer_t bin;
+    gen_t g;
+    char *end;
+
+    memset(&cur, 0, sizeof(cur));
+    cur.n = DEF_N;
+    parse_dist(&cur.size, "size", DEF_SIZE, SIZE_QUANTUM);
+    parse_dist(&cur.life, "life", DEF_LIFE, 1);
+    parse_phase(&cur, "grow=" DEF_GROW);
+    cur.max = DEF_MAX;
+
+    while ((c = getopt(argc, argv, "hbcus:p:")) != EOF) {
+	switch (c) {
+	case 'b':
+	    binary = 1;
+	    break;
+	case 'u':
+	    write_util = 1;
+	    break;
+	case 'c':
+	    check_only = 1;
+	    break;
+	case 's':
+	    errno = 0;
+	    seed = strtoull(optarg, &end, 0);
+	    if (*end || errno)
+		app_error("Bogus seed");
+	    break;
+	case 'p':
+	    if (nphases == MAX_PHASES)
+		app_error("Too many phases");
+	    parse_phase(&cur, optarg);
+	    phases[nphases++] = cur;
+	    break;
+	case 'h':
+	default:
+	    usage();
+	    exit(c != 'h');
+	}
+    }
+    if (optind != argc - 1) {
+	usage();
+	exit(1);
+    }
+    path = argv[optind];
+
+    if (check_only) {
+	if (check_trace(path, errmsg) < 0) {
+	    fprintf(stderr, "%s: %s\n", path, errmsg);
+	    exit(1);
+	}
+	printf("%s: balanced\n", path);
+	exit(0);
+    }
+
+    if (nphases == 0)
+	phases[nphases++] = cur;
+    for (i = 0; i < nphases; i++) {
+	if (phases[i].n > LONG_MAX - max_ids)
+	    app_error("Too many requests");
+	max_ids += phases[i].n;
+    }
+    if ((unsigned long)max_ids >= SIZE_MAX / sizeof(death_t))
+	app_error("Too many requests for the generator state");
+
+    memset(&g, 0, sizeof(g));
+    g.heap = malloc((max_ids + 1) * sizeof(death_t));
+    g.live = malloc((max_ids + 1) * sizeof(long));
+    g.pos = malloc((max_ids + 1) * sizeof(long));
+    g.size = malloc((max_ids + 1) * sizeof(unsigned long long));
+    if (!g.heap || !g.live || !g.pos || !g.size)
+	app_error("Out of memory for the generator state");
+
+    /*
+     * The text header gives the counts before the requests, so make a
+     * counting pass first; the trace depends only on the seed, so the
+     * second pass makes exactly the same requests.
+     */
+    generate(&g, phases, nphases, seed, max_ids);
+
+    if (binary) {
+	if (tracebin_create(path, &bin, g.peak_bytes, 1) < 0) {
+	    perror(path);
+	    exit(1);
+	}
+	g.bin = &bin;
+    }
+    else {
+	if ((g.fp = fopen(path, "w")) == NULL) {
+	    perror(path);
+	    exit(1);
+	}
+	setvbuf(g.fp, NULL, _IOFBF, 1 << 20);
+	fprintf(g.fp, "%lld\n%ld\n%ld\n%d\n", g.peak_bytes, g.next_id, g.ops, 1);
+    }
+    generate(&g, phases, nphases, seed, max_ids);
+    if (binary ? (g.error || tracebin_finish(&bin) < 0) :
+	(ferror(g.fp) || fclose(g.fp) != 0)) {
+	perror(path);
+	unlink(path);
+	exit(1);
+    }
+
+    if (check_trace(path, errmsg) < 0) {
+	fprintf(stderr, "%s: %s\n", path, errmsg);
+	exit(1);
+    }
+    printf("%s: %ld ops, %ld ids, peak %lld bytes live, balanced\n",
+	   path, g.ops, g.next_id, g.peak_bytes);
+
+    if (write_util) {
+	if (strlen(path) + 6 > sizeof(utilpath))
+	    app_error("Trace path too long for -u");
+	sprintf(utilpath, "%s.util", path);
+	if ((fp = fopen(utilpath, "w")) == NULL ||
+	    fprintf(fp, "%.6f\n", g.peak_ref ? 
+		    (double)g.peak_bytes / g.peak_ref : 0) < 0 ||
+	    fclose(fp) != 0) {
+	    perror(utilpath);
+	    exit(1);
+	}
+    }
+    exit(0);
+}
+
+/*
+ * usage - print help message
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: gentrace [-hbu] [-s <seed>] [-p <phase>]... <tracefile>\n");
+    fprintf(stderr, "       gentrace -c <tracefile>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b          Write a binary trace.\n");
+    fprintf(stderr, "\t-c          Only check that <tracefile> is balanced.\n");
+    fprintf(stderr, "\t-h          Print this message.\n");
+    fprintf(stderr, "\t-p <phase>  Add a phase, e.g. n=100000,size=zipf:4096:1.1,\n");
+    fprintf(stderr, "\t            life=exp:500,realloc=0.1,grow=mul:2,end=free\n");
+    fprintf(stderr, "\t            (see gentrace.c for all the keys).\n");
+    fprintf(stderr, "\t-s <seed>   Seed of the random numbers (default 1).\n");
+    fprintf(stderr, "\t-u          Also write <tracefile>.util, the utilization of an\n");
+    fprintf(stderr, "\t            allocator with no fragmentation (see gentrace.c).\n");
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg)
+{
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}
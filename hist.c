@@ -0,0 +1,132 @@
+/*
+ * hist.c - log-linear histograms of per-request latencies, and the
+ *          calibration of the tick counter they are measured with
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "hist.h"
+
+#define CALIBRATE_NS 20000000 /* spend 20 ms calibrating the ticks */
+#define OVERHEAD_RUNS 1000    /* back-to-back reads to find the overhead */
+
+/*
+ * bucket - the bucket that value v is counted in
+ */
+static int bucket(uint64_t v)
+{
+    int e;
+
+    if (v < HIST_SUB)
+	return (int)v;
+    e = 63 - __builtin_clzll(v);
+    return (e - HIST_SUB_BITS + 1) * HIST_SUB + 
+	(int)((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/*
+ * bucket_high - the largest value counted in bucket b
+ */
+static uint64_t bucket_high(int b)
+{
+    int e;
+    uint64_t width;
+
+    if (b < HIST_SUB)
+	return b;
+    e = b / HIST_SUB + HIST_SUB_BITS - 1;
+    width = (uint64_t)1 << (e - HIST_SUB_BITS);
+    return ((uint64_t)(HIST_SUB + b % HIST_SUB) << (e - HIST_SUB_BITS)) + 
+	width - 1;
+}
+
+/*
+ * hist_reset - empty a histogram
+ */
+void hist_reset(hist_t *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+/*
+ * hist_add - record the value v
+ */
+void hist_add(hist_t *h, uint64_t v)
+{
+    h->buckets[bucket(v)]++;
+    h->count++;
+    if (v > h->max)
+	h->max = v;
+}
+
+/*
+ * hist_percentile - return the value that pct percent of the recorded
+ *    values are at or below, to within the width of its bucket
+ */
+uint64_t hist_percentile(hist_t *h, double pct)
+{
+    uint64_t rank, seen = 0;
+    int b;
+
+    if (h->count == 0)
+	return 0;
+    rank = (uint64_t)(pct / 100.0 * h->count + 0.5);
+    if (rank < 1)
+	rank = 1;
+    for (b = 0; b < HIST_BUCKETS; b++) {
+	seen += h->buckets[b];
+	if (seen >= rank)
+	    break;
+    }
+    return (bucket_high(b) < h->max) ? bucket_high(b) : h->max;
+}
+
+/*
+ * now_ns - read the monotonic clock in nanoseconds
+ */
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * hist_ticks_per_ns - return the rate of hist_ticks, measured against
+ *    the monotonic clock the first time we are called
+ */
+double hist_ticks_per_ns(void)
+{
+    static double rate = 0;
+    uint64_t ns, ticks;
+
+    if (rate == 0) {
+	ns = now_ns();
+	ticks = hist_ticks();
+	while (now_ns() - ns < CALIBRATE_NS)
+	    ;
+	rate = (double)(hist_ticks() - ticks) / (now_ns() - ns);
+    }
+    return rate;
+}
+
+/*
+ * hist_ticks_overhead - return the fewest ticks seen between two
+ *    back-to-back reads of the counter, which every measured latency
+ *    includes
+ */
+uint64_t hist_ticks_overhead(void)
+{
+    uint64_t t, best = (uint64_t)-1;
+    int i;
+
+    for (i = 0; i < OVERHEAD_RUNS; i++) {
+	t = hist_ticks();
+	t = hist_ticks() - t;
+	if (t < best)
+	    best = t;
+    }
+    return best;
+}
@@ -0,0 +1,51 @@
+/*
+ * hist.h - log-linear histograms of per-request latencies
+ *
+ * Values below HIST_SUB get a bucket each. Above that, each power of
+ * two is split into HIST_SUB equal buckets, so a value is recorded to
+ * within 1/HIST_SUB of itself whatever its magnitude, and the whole
+ * 64-bit range fits in HIST_BUCKETS counters.
+ */
+#ifndef __HIST_H_
+#define __HIST_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS  ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+    uint64_t count;                  /* number of values recorded */
+    uint64_t max;                    /* largest value recorded */
+    uint64_t buckets[HIST_BUCKETS];  /* counts per bucket */
+} hist_t;
+
+void hist_reset(hist_t *h);
+void hist_add(hist_t *h, uint64_t v);
+uint64_t hist_percentile(hist_t *h, double pct);
+
+/* 
+ * hist_ticks - read a cheap, monotonic tick counter: the time stamp
+ *    counter on x86, and a nanosecond clock elsewhere
+ */
+static inline uint64_t hist_ticks(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned hi, lo;
+
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+double hist_ticks_per_ns(void);
+uint64_t hist_ticks_overhead(void);
+
+#endif /* __HIST_H_ */
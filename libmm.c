@@ -0,0 +1,298 @@
+/*
+ * libmm.c - use mm.c as the allocator of a real program
+ *
+ * Preloaded into a process, this library answers its malloc, free,
+ * realloc, calloc, posix_memalign, memalign, aligned_alloc, valloc,
+ * pvalloc and malloc_usable_size with mm.c, allocating from a memlib
+ * heap backed by real mmap'd memory. That way the package can be
+ * measured (RSS, run time) under real programs rather than traces:
+ *
+ *     unix> LD_PRELOAD=./libmm.so /usr/bin/time -v ./server
+ *
+ * The environment sets up the heap:
+ *
+ *     LIBMM_HEAP     the most the heap may grow to, with an optional
+ *                    K, M or G suffix (default 1G). Requests for more
+ *                    fail with ENOMEM without reaching mm.c.
+ *     LIBMM_BACKING  the memlib backing: "mmap" (default), optionally
+ *                    with "+thp" and/or "+populate"
+ *
+ * mm.c isn't thread-safe, so every call takes one lock. fork() holds
+ * the lock, so that the child's copy of the heap is never caught in
+ * the middle of a call, and the child starts with the lock free.
+ *
+ * Blocks the program got some other way, such as the dynamic loader's
+ * own, are never passed to mm.c: free ignores them. mm.c is 32-bit
+ * only, so this library is built with CFLAGS and can be preloaded only
+ * into 32-bit programs.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define DEFAULT_HEAP (1UL << 30) /* default LIBMM_HEAP */
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int ready;          /* heap is set up */
+
+/* Was p allocated by mm.c? */
+#define OURS(p) (ready && (char *)(p) >= (char *)mem_heap_lo() && \
+		 (char *)(p) <= (char *)mem_heap_hi())
+
+/*
+ * die - report a fatal error without allocating
+ */
+static void die(char *msg)
+{
+    if (write(STDERR_FILENO, "libmm: ", 7) < 0 ||
+	write(STDERR_FILENO, msg, strlen(msg)) < 0 ||
+	write(STDERR_FILENO, "\n", 1) < 0)
+	; /* nothing more we can do */
+    abort();
+}
+
+/*
+ * parse_size - convert a byte count with an optional K, M or G suffix.
+ *    Returns 0 if str is not a size or doesn't fit a size_t.
+ */
+static size_t parse_size(char *str)
+{
+    char *end;
+    unsigned long long n;
+    int shift = 0;
+
+    errno = 0;
+    n = strtoull(str, &end, 10);
+    if (errno || end == str)
+	return 0;
+    switch (*end) {
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    }
+    if (*end != '\0' || (n << shift) >> shift != n ||
+	(n << shift) > (size_t)-1)
+	return 0;
+    return n << shift;
+}
+
+/*
+ * setup - set up the heap on the first call, with the lock held
+ */
+static void setup(void)
+{
+    char *heap = getenv("LIBMM_HEAP");
+    char *backing = getenv("LIBMM_BACKING");
+    size_t limit = DEFAULT_HEAP;
+
+    if (heap && (limit = parse_size(heap)) == 0)
+	die("bogus LIBMM_HEAP");
+    if (mem_set_backing(backing ? backing : "mmap") < 0 ||
+	!strcmp(mem_backing_name(), "malloc"))
+	die("LIBMM_BACKING must be mmap, optionally with +thp and/or +populate");
+    mem_set_limit(limit);
+    mem_init();
+    if (mm_init() < 0)
+	die("mm_init failed");
+    ready = 1;
+}
+
+/*
+ * The lock is held across fork(), and reset in the child
+ */
+static void fork_prepare(void)
+{
+    pthread_mutex_lock(&lock);
+}
+
+static void fork_parent(void)
+{
+    pthread_mutex_unlock(&lock);
+}
+
+static void fork_child(void)
+{
+    pthread_mutex_init(&lock, NULL);
+}
+
+__attribute__((constructor))
+static void libmm_init(void)
+{
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+
+/*
+ * lock_heap - take the lock, setting up the heap if this is the first call
+ */
+static inline void lock_heap(void)
+{
+    pthread_mutex_lock(&lock);
+    if (!ready)
+	setup();
+}
+
+/*
+ * too_big - can't size bytes, aligned to alignment, come from a heap
+ *    of LIBMM_HEAP? mm.c rounds and pads sizes without checking for
+ *    overflow, so sizes near SIZE_MAX must never reach it. Call with
+ *    the lock held.
+ */
+static inline int too_big(size_t alignment, size_t size)
+{
+    size_t limit = mem_limit_bytes();
+
+    return size > limit || alignment > limit - size;
+}
+
+/*
+ * aligned - allocate size bytes aligned to alignment, a power of 2
+ */
+static void *aligned(size_t alignment, size_t size)
+{
+    void *p = NULL;
+
+    lock_heap();
+    if (alignment && !too_big(alignment, size))
+	p = mm_memalign(alignment, size ? size : 1);
+    pthread_mutex_unlock(&lock);
+    if (p == NULL)
+	errno = ENOMEM;
+    return p;
+}
+
+/*
+ * round_power_2 - round x up to a power of 2, or 0 if there is none
+ */
+static size_t round_power_2(size_t x)
+{
+    size_t p = 1;
+
+    while (p && p < x)
+	p <<= 1;
+    return p;
+}
+
+/******************************
+ * The allocator calls replaced
+ ******************************/
+
+void *malloc(size_t size)
+{
+    void *p = NULL;
+
+    lock_heap();
+    if (!too_big(0, size))
+	p = mm_malloc(size ? size : 1); /* malloc(0) must be freeable */
+    pthread_mutex_unlock(&lock);
+    if (p == NULL)
+	errno = ENOMEM;
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL)
+	return;
+    lock_heap();
+    if (OURS(ptr))
+	mm_free(ptr);
+    pthread_mutex_unlock(&lock);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    if (ptr == NULL)
+	return malloc(size);
+    if (size == 0) {
+	free(ptr);
+	return NULL;
+    }
+    lock_heap();
+    if (!OURS(ptr))
+	die("realloc of a block that mm.c didn't allocate");
+    p = too_big(0, size) ? NULL : mm_realloc(ptr, size);
+    pthread_mutex_unlock(&lock);
+    if (p == NULL)
+	errno = ENOMEM;
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p = NULL;
+    size_t bytes = nmemb * size;
+
+    if (size && nmemb > (size_t)-1 / size) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    /* Not malloc: gcc would turn malloc and memset back into calloc */
+    lock_heap();
+    if (!too_big(0, bytes))
+	p = mm_malloc(bytes ? bytes : 1);
+    pthread_mutex_unlock(&lock);
+    if (p == NULL)
+	errno = ENOMEM;
+    else
+	memset(p, 0, bytes); /* freed blocks are reused as is */
+    return p;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *p;
+
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)))
+	return EINVAL;
+    if ((p = aligned(alignment, size)) == NULL)
+	return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    return aligned(round_power_2(alignment), size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return aligned(round_power_2(alignment), size);
+}
+
+void *valloc(size_t size)
+{
+    return aligned(getpagesize(), size);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t page = getpagesize();
+
+    if (size > (size_t)-1 - (page - 1)) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    return aligned(page, (size + page - 1) & ~(page - 1));
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+    size_t n = 0;
+
+    if (ptr == NULL)
+	return 0;
+    lock_heap();
+    if (OURS(ptr))
+	n = mm_usable_size(ptr);
+    pthread_mutex_unlock(&lock);
+    return n;
+}
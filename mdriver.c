@@ -7,6 +7,7 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE     /* for sched_setaffinity */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -14,11 +15,24 @@
 #include <string.h>
 #include <assert.h>
 #include <float.h>
+#include <math.h>
 #include <time.h>
+#include <sched.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/utsname.h>
+#include <pthread.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "ftimer.h"
+#include "tracefile.h"
+#include "tracestream.h"
+#include "hist.h"
+#include "perfctr.h"
+#include "engine.h"
 #include "config.h"
 
 /**********************
@@ -27,8 +41,23 @@
 
 /* Misc */
 #define MAXLINE     1024 /* max string size */
+#define RANGECHUNK  4096 /* range records obtained from libc at a time */
+#define IDMAP_MIN     64 /* initial number of id map slots (a power of 2) */
 #define HDRLINES       4 /* number of header lines in a trace file */
-#define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define LINENUM(i) ((i)+5) /* cnvt trace request nums to linenums (origin 1) */
+
+/* getopt_long codes of the options that have no short form */
+#define OPT_JSON     256 /* --json=FILE */
+#define OPT_CSV      257 /* --csv=FILE */
+#define OPT_BASELINE 258 /* --baseline=SO */
+#define OPT_CANDIDATE 259 /* --candidate=SO */
+#define OPT_SUITE    260 /* --suite=NAME */
+#define OPT_ALLOCATOR 261 /* --allocator=SO */
+#define OPT_COLD     262 /* --cold */
+#define OPT_STARTUP  263 /* --startup=N */
+#define OPT_TOUCH    264 /* --touch=F */
+#define OPT_LOCALITY 265 /* --locality */
+#define OPT_SOAK     266 /* --soak=N */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
@@ -37,26 +66,48 @@
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* 
+ * Records the extent of each block's payload. The records form an
+ * AVL tree ordered by payload address.
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* payloads at lower addresses */
+    struct range_t *right; /* payloads at higher addresses */
+    int height;            /* height of the subtree rooted here */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
+/*
+ * In streaming mode the trace is never held in memory, so instead of
+ * the blocks/block_sizes arrays indexed by id, the live blocks are
+ * kept in an open-addressing hash table keyed by id. The table only
+ * grows with the number of live blocks, not with num_ids.
+ */
+typedef struct {
+    uint64_t index;        /* trace id of the block, or NO_ID if unused */
+    size_t size;           /* payload size */
+    char *p;               /* payload pointer returned by mm */
+} idslot_t;
+
+#define NO_ID UINT64_MAX
+
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
+    idslot_t *slots;       /* the table... */
+    size_t mask;           /* ... its number of slots - 1 ... */
+    size_t live;           /* ... and how many slots are in use */
+} idmap_t;
 
-/* Holds the information for one trace file*/
+/* 
+ * Holds the information for one trace file. read_trace checks that
+ * the trace fits in memory, so its counts, ids and sizes fit a size_t.
+ */
 typedef struct {
-    int sugg_heapsize;   /* suggested heap size (unused) */
-    int num_ids;         /* number of alloc/realloc ids */
-    int num_ops;         /* number of distinct requests */
-    int weight;          /* weight for this trace (unused) */
+    uint64_t sugg_heapsize; /* suggested heap size (unused) */
+    size_t num_ids;      /* number of alloc/realloc ids */
+    size_t num_ops;      /* number of distinct requests */
+    uint64_t weight;     /* weight for this trace (unused) */
+    int num_threads;     /* 1 + highest thread id in the trace */
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
@@ -70,21 +121,117 @@ typedef struct {
 typedef struct {
     trace_t *trace;  
     range_t *ranges;
+    char *path;      /* trace to re-read on each run in streaming mode */
+    double ops;      /* requests in it, counted by each such run */
 } speed_t;
 
+/* Latency percentiles, in ns, for one type of request in one trace */
+typedef struct {
+    double count;    /* number of requests of this type */
+    double p50, p90, p99, p999;
+    double max;
+} lat_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
     double ops;      /* number of ops (malloc/free/realloc) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
     double secs;     /* number of secs needed to run the trace */
+    double ci;       /* half-width of the 95% CI of secs (0 if unknown) */
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    double heap;     /* brk size in bytes after the util run (0 for libc) */
+    double resident; /* peak resident heap bytes in the util run (0 for libc) */
+    lat_t lat[3];    /* latencies of ALLOC, FREE and REALLOC requests (-L) */
+    double ctr[PERFCTR_NUM]; /* hardware events per request, -1 if n/a (-e) */
+    double init_secs;    /* cold time of mm_init (--startup) ... */
+    double startup_secs; /* ... and of the first requests after it ... */
+    double startup_ops;  /* ... of which there are this many */
+    double touch_alloc_secs; /* time in the package (--touch) ... */
+    double touch_app_secs;   /* ... and in touching the payloads ... */
+    double touch_blocks;     /* ... of this many blocks */
+    double dist;       /* median bytes between consecutive allocations, */
+    double pages;      /* mean pages and ... */
+    double page_fill;  /* ... share of their bytes the live set uses, */
+    double line_fill;  /* the same share of the lines, and the */
+    double ws_pages;   /* pages touched per LOCALITY_WINDOW requests */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* One request in a replay thread's share of a trace */
+typedef struct {
+    traceop_t op;
+    size_t seq;          /* number of earlier requests on op.index */
+} threadop_t;
+
+/* A thread replaying its share of a trace */
+typedef struct {
+    threadop_t *ops;     /* its requests and barriers, in trace order */
+    size_t num_ops;      /* number of entries in ops */
+    size_t requests;     /* number of them that are not barriers */
+    double secs;         /* its fastest time through them */
+    struct threads_t *shared;
+    pthread_t thread;
+} replayer_t;
+
+/* Holds the params to eval_mm_threads_speed */
+typedef struct threads_t {
+    trace_t *trace;
+    int workers;         /* number of replay threads */
+    replayer_t *replayers;
+    size_t *done;        /* requests completed so far on each id */
+    pthread_barrier_t barrier;
+} threads_t;
+
+/* How the student's package is evaluated on each trace */
+typedef struct {
+    int stream;      /* stream traces instead of loading them (-s) */
+    int latency;     /* also time every request on its own (-L) */
+    int counters;    /* also count hardware events per request (-e) */
+    int cold;        /* flush the caches before each timed run (--cold) */
+    int startup;     /* also time mm_init and this many requests after it
+			from cold (--startup) */
+    double touch;    /* also replay touching this fraction of the live
+			blocks between requests (--touch) */
+    int locality;    /* also measure how the live blocks are laid out
+			(--locality) */
+} evalopts_t;
+
+/* What a forked worker sends back to the driver for its trace */
+typedef struct {
+    stats_t stats;   /* the trace's stats */
+    int errors;      /* number of errors the worker found */
+} result_t;
+
+/* A forked worker evaluating one trace */
+typedef struct {
+    pid_t pid;       /* the worker's pid, or 0 if the slot is free */
+    int fd;          /* read end of the pipe its result comes back on */
+    int tracenum;    /* the trace it is running */
+} worker_t;
+
+/* How a candidate package compares with a baseline on one trace */
+typedef struct {
+    double ops;      /* number of ops in the trace */
+    int valid[2];    /* did the baseline [0] and the candidate [1] pass it? */
+    double util[2];  /* their space utilizations */
+    double secs[2];  /* their mean times per run */
+    double dthru;    /* candidate throughput / baseline throughput - 1 */
+    double ci;       /* half-width of the 95% CI of dthru */
+    int runs;        /* number of ABBA rounds timed (0 if not timed) */
+    int regressed;   /* did the candidate regress on this trace? */
+} abstats_t;
+
+/* Run-wide facts recorded with the results */
+typedef struct {
+    char time[32];           /* when the run finished, ISO 8601 UTC */
+    struct utsname host;     /* the machine */
+    long cpus;               /* number of online cpus */
+} runinfo_t;
+
 /********************
  * Global variables
  *******************/
@@ -92,6 +239,19 @@ int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
+/* The package being evaluated; the one linked in unless --baseline */
+static engine_t *engine;
+
+/* The malloc the eval_libc routines run, libc's or another's (-l) */
+static sysalloc_t *sysalloc;
+
+/* Where --json=- or --csv=- write: stdout as it was before the human
+   output was sent to stderr to keep it out of the way */
+static FILE *results_stdout = NULL;
+
+/* Unused range records, recycled instead of going back to libc */
+static range_t *free_ranges = NULL;
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
@@ -100,36 +260,119 @@ static char *default_tracefiles[] = {
     DEFAULT_TRACEFILES, NULL
 };
 
+/* The shared objects of other allocators that -l looks for */
+static char *system_allocators[] = {
+    SYSTEM_ALLOCATORS, NULL
+};
+
+/* The large suite (--suite=large), file names in LARGE_TRACEDIR */
+static char *large_suite[] = {
+    LARGE_TRACEFILES, NULL
+};
+
 
 /********************* 
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
-static int add_range(range_t **ranges, char *lo, int size, 
-		     int tracenum, int opnum);
+/* these functions manipulate range trees */
+static int add_range(range_t **ranges, char *lo, size_t size, 
+		     int tracenum, uint64_t opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
 
+/* these functions manipulate the id map used in streaming mode */
+static void idmap_init(idmap_t *map);
+static idslot_t *idmap_find(idmap_t *map, uint64_t index);
+static void idmap_insert(idmap_t *map, uint64_t index, char *p, size_t size);
+static void idmap_delete(idmap_t *map, idslot_t *slot);
+static void idmap_free(idmap_t *map);
+
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
 static void free_trace(trace_t *trace);
 
-/* Routines for evaluating the correctness and speed of libc malloc */
+/* Routines for evaluating the correctness and speed of libc malloc,
+   or of another allocator in its place */
 static int eval_libc_valid(trace_t *trace, int tracenum);
 static void eval_libc_speed(void *ptr);
+static void eval_sysalloc(sysalloc_t *a, char **tracefiles, int n,
+			  stats_t *stats);
+static void eval_libc_stream_speed(void *ptr);
+static void eval_sysalloc_stream(sysalloc_t *a, char **tracefiles, int n,
+				 stats_t *stats);
+
+/* Measures what the replay loops cost without any allocator */
+static void eval_null_speed(void *ptr);
+static double replay_overhead(trace_t *trace);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   double *resident);
+static void sample_resident(uint64_t opnum, size_t *heap, double *peak);
 static void eval_mm_speed(void *ptr);
 
+/* The same, streaming the trace from disk instead of holding it */
+static int eval_mm_stream_valid(char *path, int tracenum, range_t **ranges,
+				double *util, double *ops, double *resident);
+static void eval_mm_stream_speed(void *ptr);
+static void eval_null_stream_speed(void *ptr);
+
+/* Evaluate one trace in this process, or many in forked workers */
+static void eval_mm_trace(char *filename, int tracenum, evalopts_t *opts,
+			  range_t **ranges, stats_t *stats);
+static void eval_mm_parallel(char **tracefiles, int num_tracefiles,
+			     evalopts_t *opts, int jobs, int pin, stats_t *stats);
+
+/* Time each request of a trace on its own */
+static void eval_mm_latency(trace_t *trace, stats_t *stats);
+
+/* Count the hardware events behind a trace's requests */
+static void eval_mm_counters(trace_t *trace, stats_t *stats);
+
+/* Time the start of a trace from cold */
+static void eval_mm_startup(trace_t *trace, int n, stats_t *stats);
+
+/* Replay a trace with the payloads in use */
+static void eval_mm_touch(trace_t *trace, double frac, stats_t *stats);
+
+/* Measure how a trace's blocks are laid out in the heap */
+static void eval_mm_locality(trace_t *trace, stats_t *stats);
+
+/* Replay traces over and over on one heap */
+static void eval_mm_soak(char **tracefiles, int n, stats_t *stats, int iters);
+
+/* Replay a trace's threads on several threads at once */
+static void eval_mm_threads(trace_t *trace, int tracenum, int max_workers);
+static void eval_mm_threads_speed(void *ptr);
+
+/* Compare a candidate package against a baseline */
+static void eval_ab_trace(engine_t *eng[2], char *filename, int tracenum,
+			  range_t **ranges, abstats_t *ab);
+static int eval_ab(engine_t *eng[2], char **tracefiles, int n);
+
 /* Various helper routines */
-static void printresults(int n, stats_t *stats);
+static void printresults(int n, stats_t *stats, evalopts_t *opts);
+static void printlatency(int n, stats_t *stats);
+static void printcounters(int n, stats_t *stats);
+static void printstartup(int n, stats_t *stats);
+static void printtouch(int n, stats_t *stats);
+static void printsuite(int n, char **tracefiles, stats_t *stats,
+		       double *util_ref, stats_t *libc_stats);
+static double read_util_ref(char *path);
+static void printcompare(int n, stats_t *mm_stats, int nsys,
+			 sysalloc_t *sys, stats_t **sys_stats);
+static void write_results(char *path, int json, char **tracefiles, int n,
+			  stats_t *mm_stats, int nsys, sysalloc_t *sys,
+			  stats_t **sys_stats, double libc_thruput, 
+			  evalopts_t *opts, int numcorrect, double avg_util,
+			  double throughput, double perfindex);
+static unsigned long long parse_size(char *str);
 static void usage(void);
 static void unix_error(char *msg);
-static void malloc_error(int tracenum, int opnum, char *msg);
+static void malloc_error(int tracenum, uint64_t opnum, char *msg);
 static void app_error(char *msg);
 
 /**************
@@ -138,27 +381,69 @@ static void app_error(char *msg);
 int main(int argc, char **argv)
 {
     int i;
-    char c;
+    int c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
     trace_t *trace = NULL;     /* stores a single trace file in memory */
     range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
-    speed_t speed_params;      /* input parameters to the xx_speed routines */ 
+    sysalloc_t sys[MAX_ALLOCATORS];     /* libc and the others (-l) ... */
+    stats_t *sys_stats[MAX_ALLOCATORS]; /* ... their stats for each trace */
+    int nsys = 0;                       /* ... and how many there are */
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
+    char *allocators[MAX_ALLOCATORS]; /* more to compare (--allocator) */
+    int num_allocators = 0;
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    evalopts_t opts = {0}; /* How to evaluate each trace (-s, -L, -e, ...) */
+    perfctr_t perfctr;     /* to see which hardware counters we have */
+    int jobs = 0;        /* If set, run traces in this many workers (-j) */
+    int pin = 0;         /* If set, pin each worker to its own core (-p) */
+    int threads = 0;     /* If set, replay trace threads on up to this many (-T) */
+    int soak = 0;        /* If set, replay the traces this many times (--soak) */
+    size_t heap_limit = 0; /* maximum heap size (set by -m) */
+    unsigned long long size;
+    char *backing = NULL;  /* heap backing (set by -b) */
+    char *baseline = NULL; /* If set, compare against this package (--baseline) */
+    char *candidate = NULL;/* ... this one instead of mm.c (--candidate) */
+    engine_t engines[2];   /* the packages being compared */
+    engine_t *eng[2];
+    char *json_path = NULL; /* If set, also write the results as JSON (--json) */
+    char *csv_path = NULL;  /* If set, also write the results as CSV (--csv) */
+    char **suite = NULL; /* If set, run this suite (--suite) */
+    double *suite_util = NULL; /* each suite trace's util reference */
+    int tracedir_set = 0;  /* set by -t */
+    char *endp;
+    static struct option long_options[] = {
+	{"json", required_argument, NULL, OPT_JSON},
+	{"csv", required_argument, NULL, OPT_CSV},
+	{"baseline", required_argument, NULL, OPT_BASELINE},
+	{"candidate", required_argument, NULL, OPT_CANDIDATE},
+	{"suite", required_argument, NULL, OPT_SUITE},
+	{"allocator", required_argument, NULL, OPT_ALLOCATOR},
+	{"cold", no_argument, NULL, OPT_COLD},
+	{"startup", required_argument, NULL, OPT_STARTUP},
+	{"touch", required_argument, NULL, OPT_TOUCH},
+	{"locality", no_argument, NULL, OPT_LOCALITY},
+	{"soak", required_argument, NULL, OPT_SOAK},
+	{NULL, 0, NULL, 0}
+    };
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
+    double libc_thruput = 0;   /* libc's ops/sec on these traces, if timed */
+    double thru_cap;
     int numcorrect;
     
+    engine = engine_builtin();
+
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt_long(argc, argv, "f:t:b:m:j:T:hvVgalspLe",
+			    long_options, NULL)) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -177,19 +462,127 @@ int main(int argc, char **argv)
 	    strcpy(tracedir, optarg);
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
+	    tracedir_set = 1;
+	    break;
+	case 'b': /* How memlib backs the simulated heap */
+	    if (mem_set_backing(optarg) < 0) {
+		printf("ERROR: Bogus heap backing \"%s\"\n", optarg);
+		usage();
+		exit(1);
+	    }
+	    backing = optarg;
+	    break;
+	case 'm': /* Maximum heap size, e.g. 64G */
+	    if ((size = parse_size(optarg)) == 0) {
+		printf("ERROR: Bogus heap size \"%s\"\n", optarg);
+		usage();
+		exit(1);
+	    }
+	    if (size > mem_limit_max()) {
+		printf("ERROR: Heap size \"%s\" is too big for the %d-bit driver's"
+		       " address space\n", optarg, (int)sizeof(void *) * 8);
+		exit(1);
+	    }
+	    heap_limit = size;
+	    mem_set_limit(heap_limit);
 	    break;
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
-        case 'l': /* Run libc malloc */
+        case 'l': /* Run libc malloc and the other allocators found */
             run_libc = 1;
             break;
+        case 's': /* Stream traces from disk in bounded memory */
+            opts.stream = 1;
+            break;
+        case 'L': /* Time each request and report latency percentiles */
+            opts.latency = 1;
+            break;
+        case 'e': /* Count hardware events with perf_event_open */
+            opts.counters = 1;
+            break;
+	case 'j': /* Evaluate traces in parallel forked workers */
+	    if ((jobs = atoi(optarg)) < 1) {
+		printf("ERROR: Bogus number of workers \"%s\"\n", optarg);
+		usage();
+		exit(1);
+	    }
+	    break;
+        case 'p': /* Pin each worker to a core */
+            pin = 1;
+            break;
+	case 'T': /* Replay each trace's threads on up to this many threads */
+	    if ((threads = atoi(optarg)) < 1) {
+		printf("ERROR: Bogus number of threads \"%s\"\n", optarg);
+		usage();
+		exit(1);
+	    }
+	    break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
         case 'V': /* Be more verbose than -v */
             verbose = 2;
             break;
+        case OPT_JSON: /* Write the results as JSON ("-" for stdout) */
+	    json_path = optarg;
+	    break;
+        case OPT_CSV: /* Write the results as CSV ("-" for stdout) */
+	    csv_path = optarg;
+	    break;
+        case OPT_BASELINE: /* Compare against the package in this .so */
+	    baseline = optarg;
+	    break;
+        case OPT_CANDIDATE: /* Compare this .so instead of mm.c */
+	    candidate = optarg;
+	    break;
+        case OPT_ALLOCATOR: /* Also compare the malloc in this .so (-l) */
+	    if (num_allocators == MAX_ALLOCATORS - 1) {
+		printf("ERROR: Too many allocators\n");
+		exit(1);
+	    }
+	    allocators[num_allocators++] = optarg;
+	    run_libc = 1;
+	    break;
+        case OPT_COLD: /* Flush the caches before each timed run */
+	    opts.cold = 1;
+	    break;
+        case OPT_STARTUP: /* Time mm_init and the first N requests, cold */
+	    if ((opts.startup = atoi(optarg)) < 1) {
+		printf("ERROR: Bogus number of requests \"%s\"\n", optarg);
+		usage();
+		exit(1);
+	    }
+	    break;
+        case OPT_TOUCH: /* Touch a fraction of the live blocks between ops */
+	    opts.touch = strtod(optarg, &endp);
+	    if (*endp != '\0' || !(opts.touch > 0 && opts.touch <= 1)) {
+		printf("ERROR: Bogus fraction \"%s\"\n", optarg);
+		usage();
+		exit(1);
+	    }
+	    break;
+        case OPT_LOCALITY: /* Measure how the blocks are laid out */
+	    opts.locality = 1;
+	    break;
+        case OPT_SOAK: /* Replay the traces N times on one heap */
+	    if ((soak = atoi(optarg)) < 1) {
+		printf("ERROR: Bogus number of iterations \"%s\"\n", optarg);
+		usage();
+		exit(1);
+	    }
+	    break;
+        case OPT_SUITE: /* Run the default or the large suite of traces */
+	    if (!strcmp(optarg, "large"))
+		suite = large_suite;
+	    else if (!strcmp(optarg, "default"))
+		suite = NULL;
+	    else {
+		printf("ERROR: Bogus suite \"%s\"\n", optarg);
+		usage();
+		exit(1);
+	    }
+	    break;
         case 'h': /* Print this message */
 	    usage();
             exit(0);
@@ -198,7 +591,96 @@ int main(int argc, char **argv)
             exit(1);
         }
     }
+
+    /*
+     * With the results on stdout, everything else goes to stderr, so
+     * that stdout holds nothing but the one JSON or CSV document
+     */
+    if ((json_path && !strcmp(json_path, "-")) ||
+	(csv_path && !strcmp(csv_path, "-"))) {
+	if (json_path && csv_path && 
+	    !strcmp(json_path, "-") && !strcmp(csv_path, "-")) {
+	    printf("ERROR: --json and --csv can't both write to stdout\n");
+	    usage();
+	    exit(1);
+	}
+	fflush(stdout);
+	if ((i = dup(STDOUT_FILENO)) < 0 || 
+	    (results_stdout = fdopen(i, "w")) == NULL)
+	    unix_error("Could not keep stdout for the results");
+	if (dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+	    unix_error("Could not send the output to stderr");
+    }
 	
+    /* 
+     * The large suite is too big to load, so it is always streamed,
+     * on a heap big enough for it
+     */
+    if (suite) {
+	if (tracefiles) {
+	    printf("ERROR: --suite and -f can't be used together\n");
+	    usage();
+	    exit(1);
+	}
+	if (run_libc || opts.latency || opts.counters || opts.startup ||
+	    opts.touch || opts.locality || threads || soak || baseline) {
+	    printf("ERROR: --suite=large streams its traces, so it can't be used"
+		   " with -l, -L, -e, -T, --startup, --touch, --locality, --soak"
+		   " or --baseline\n");
+	    usage();
+	    exit(1);
+	}
+	opts.stream = 1;
+	if (!tracedir_set)
+	    strcpy(tracedir, LARGE_TRACEDIR);
+	if (!heap_limit) {
+	    heap_limit = LARGE_MAX_HEAP;
+	    mem_set_limit(heap_limit);
+	}
+    }
+
+    /* The libc runs index their blocks by id, so they need the whole trace */
+    if (opts.stream && run_libc) {
+	printf("ERROR: -s and -l can't be used together\n");
+	usage();
+	exit(1);
+    }
+    if ((threads || soak) && opts.stream) {
+	printf("ERROR: -T and --soak can't be used with -s\n");
+	usage();
+	exit(1);
+    }
+    if ((opts.latency || opts.counters || opts.startup || opts.touch ||
+	 opts.locality) && opts.stream) {
+	printf("ERROR: -L, -e, --startup, --touch and --locality can't be used"
+	       " with -s\n");
+	usage();
+	exit(1);
+    }
+    if (threads && !mm_thread_safe) {
+	printf("ERROR: -T needs mm.c built with -DMM_THREAD_SAFE (mdriver-ts)\n");
+	exit(1);
+    }
+    if (pin && !jobs) {
+	printf("ERROR: -p only applies to workers started with -j\n");
+	usage();
+	exit(1);
+    }
+    if (candidate && !baseline) {
+	printf("ERROR: --candidate needs a --baseline to compare against\n");
+	usage();
+	exit(1);
+    }
+    if (baseline && (run_libc || opts.stream || opts.latency || 
+		     opts.counters || opts.startup || opts.touch || 
+		     opts.locality || jobs || threads || soak || json_path || 
+		     csv_path)) {
+	printf("ERROR: --baseline can't be used with -l, -s, -L, -e, -j, -T,"
+	       " --startup, --touch, --locality, --soak, --json or --csv\n");
+	usage();
+	exit(1);
+    }
+
     /* 
      * Check and print team info 
      */
@@ -229,7 +711,24 @@ int main(int argc, char **argv)
      * If no -f command line arg, then use the entire set of tracefiles 
      * defined in default_traces[]
      */
-    if (tracefiles == NULL) {
+    if (suite) {
+	tracefiles = suite;
+	for (num_tracefiles = 0; suite[num_tracefiles]; num_tracefiles++)
+	    ;
+	if ((suite_util = calloc(num_tracefiles, sizeof(double))) == NULL)
+	    unix_error("ERROR: calloc failed in main");
+	for (i = 0; i < num_tracefiles; i++) {
+	    sprintf(msg, "%s%s", tracedir, tracefiles[i]);
+	    if (access(msg, R_OK) < 0) {
+		printf("ERROR: %s is missing; \"make large-traces\" generates"
+		       " the large suite\n", msg);
+		exit(1);
+	    }
+	    suite_util[i] = read_util_ref(msg);
+	}
+	printf("Using the large suite in %s\n", tracedir);
+    }
+    else if (tracefiles == NULL) {
         tracefiles = default_tracefiles;
         num_tracefiles = sizeof(default_tracefiles) / sizeof(char *) - 1;
 	printf("Using default tracefiles in %s\n", tracedir);
@@ -237,11 +736,54 @@ int main(int argc, char **argv)
 
     /* Initialize the timing package */
     init_fsecs();
+    if (opts.cold) {
+	if (set_fsecs_cold() < 0) {
+	    printf("ERROR: --cold needs the USE_FCYC or USE_CLOCK timer"
+		   " (config.h)\n");
+	    exit(1);
+	}
+	if (verbose)
+	    printf("Flushing %d MB of cache before each timed run\n",
+		   COLD_CACHE_BYTES >> 20);
+    }
+
+    /* Without hardware counters -e still runs, just with nothing to show */
+    if (opts.counters) {
+	if (perfctr_open(&perfctr) < PERFCTR_NUM)
+	    printf("Warning: some hardware counters are unavailable (%s)\n",
+		   strerror(perfctr.error));
+	perfctr_close(&perfctr);
+    }
+
+    /* 
+     * Compare two packages instead of evaluating one; the exit status
+     * says whether the candidate regressed
+     */
+    if (baseline) {
+	if (engine_load(baseline, &engines[0]) < 0)
+	    app_error(engines[0].errmsg);
+	eng[0] = &engines[0];
+	if (candidate) {
+	    if (engine_load(candidate, &engines[1]) < 0)
+		app_error(engines[1].errmsg);
+	    eng[1] = &engines[1];
+	}
+	else
+	    eng[1] = engine_builtin();
+	for (i = 0; i < 2; i++)
+	    engine_start(eng[i], backing, heap_limit);
+	if (verbose || backing)
+	    printf("Using %s heap backing\n", mem_backing_name());
+	exit(eval_ab(eng, tracefiles, num_tracefiles) ? 1 : 0);
+    }
 
     /*
-     * Optionally run and evaluate the libc malloc package 
+     * Time the libc malloc package on this host: its throughput on
+     * these traces caps the throughput score. Streamed traces are
+     * never loaded whole, so -s falls back on AVG_LIBC_THRUPUT; the
+     * large suite streams libc too, for a reference on each trace.
      */
-    if (run_libc) {
+    if (run_libc || suite || !opts.stream) {
 	if (verbose > 1)
 	    printf("\nTesting libc malloc\n");
 	
@@ -249,27 +791,63 @@ int main(int argc, char **argv)
 	libc_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
 	if (libc_stats == NULL)
 	    unix_error("libc_stats calloc in main failed");
-	
-	/* Evaluate the libc malloc package using the K-best scheme */
+	if (suite)
+	    eval_sysalloc_stream(sysalloc_libc(), tracefiles, num_tracefiles,
+				 libc_stats);
+	else
+	    eval_sysalloc(sysalloc_libc(), tracefiles, num_tracefiles,
+			  libc_stats);
+
+	secs = ops = 0;
 	for (i=0; i < num_tracefiles; i++) {
-	    trace = read_trace(tracedir, tracefiles[i]);
-	    libc_stats[i].ops = trace->num_ops;
-	    if (verbose > 1)
-		printf("Checking libc malloc for correctness, ");
-	    libc_stats[i].valid = eval_libc_valid(trace, i);
-	    if (libc_stats[i].valid) {
-		speed_params.trace = trace;
-		if (verbose > 1)
-		    printf("and performance.\n");
-		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
-	    }
-	    free_trace(trace);
+	    secs += libc_stats[i].secs;
+	    ops += libc_stats[i].ops;
 	}
+	libc_thruput = ops/secs;
 
 	/* Display the libc results in a compact table */
-	if (verbose) {
+	if (verbose && run_libc) {
 	    printf("\nResults for libc malloc:\n");
-	    printresults(num_tracefiles, libc_stats);
+	    printresults(num_tracefiles, libc_stats, NULL);
+	}
+    }
+
+    /*
+     * Optionally run the same traces through the other allocators
+     * installed here and those named with --allocator
+     */
+    if (run_libc) {
+	sys[0] = *sysalloc_libc();
+	sys_stats[0] = libc_stats;
+	nsys = 1;
+	for (i = 0; system_allocators[i] && nsys < MAX_ALLOCATORS; i++) {
+	    if (sysalloc_load(system_allocators[i], &sys[nsys]) == 0)
+		nsys++;
+	    else if (verbose > 1)
+		printf("Not comparing %s: %s\n", system_allocators[i], 
+		       sys[nsys].errmsg);
+	}
+	for (i = 0; i < num_allocators; i++) {
+	    if (nsys == MAX_ALLOCATORS) {
+		printf("ERROR: Too many allocators\n");
+		exit(1);
+	    }
+	    if (sysalloc_load(allocators[i], &sys[nsys]) < 0)
+		app_error(sys[nsys].errmsg);
+	    nsys++;
+	}
+
+	for (i = 1; i < nsys; i++) {
+	    if (verbose > 1)
+		printf("\nTesting %s malloc\n", sys[i].name);
+	    if ((sys_stats[i] = (stats_t *)calloc(num_tracefiles, 
+						  sizeof(stats_t))) == NULL)
+		unix_error("sys_stats calloc in main failed");
+	    eval_sysalloc(&sys[i], tracefiles, num_tracefiles, sys_stats[i]);
+	    if (verbose) {
+		printf("\nResults for %s malloc:\n", sys[i].name);
+		printresults(num_tracefiles, sys_stats[i], NULL);
+	    }
 	}
     }
 
@@ -286,31 +864,78 @@ int main(int argc, char **argv)
     
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
+    if (verbose || backing)
+	printf("Using %s heap backing\n", mem_backing_name());
 
     /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+    if (jobs)
+	eval_mm_parallel(tracefiles, num_tracefiles, &opts, jobs, pin, mm_stats);
+    else
+	for (i=0; i < num_tracefiles; i++)
+	    eval_mm_trace(tracefiles[i], i, &opts, &ranges, &mm_stats[i]);
+
+    /* Display the mm results in a compact table (the point of --locality) */
+    if (verbose || opts.locality) {
+	printf("\nResults for mm malloc (%s heap):\n", mem_backing_name());
+	printresults(num_tracefiles, mm_stats, &opts);
+	printf("\n");
+    }
+
+    /* The same traces through every allocator, side by side */
+    if (nsys > 0) {
+	printf("Throughput (Kops/sec) of mm malloc and of each allocator:\n");
+	printcompare(num_tracefiles, mm_stats, nsys, sys, sys_stats);
+	printf("\n");
+    }
+
+    /* The comparison with libc is the point of the large suite */
+    if (suite) {
+	printf("Against each trace's utilization reference, and libc malloc"
+	       " on this host:\n");
+	printsuite(num_tracefiles, tracefiles, mm_stats, suite_util, 
+		   libc_stats);
+	printf("\n");
+    }
+
+    /* Tail latencies are the point of -L, so print them even without -v */
+    if (opts.latency) {
+	printf("Latency of mm malloc requests (ns):\n");
+	printlatency(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (opts.counters) {
+	printf("Hardware events per mm malloc request:\n");
+	printcounters(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (opts.startup) {
+	printf("Startup of mm malloc from cold (median of %d runs):\n",
+	       STARTUP_RUNS);
+	printstartup(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (opts.touch) {
+	printf("Time with %.3g of the live blocks touched between requests"
+	       " (ns/op):\n", opts.touch);
+	printtouch(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Optionally see how each trace scales when its threads run at once */
+    if (threads) {
+	for (i=0; i < num_tracefiles; i++) {
+	    if (!mm_stats[i].valid)
+		continue;
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    eval_mm_threads(trace, i, threads);
+	    free_trace(trace);
 	}
-	free_trace(trace);
+	printf("\n");
     }
 
-    /* Display the mm results in a compact table */
-    if (verbose) {
-	printf("\nResults for mm malloc:\n");
-	printresults(num_tracefiles, mm_stats);
+    /* Optionally see how the package holds up on a heap that lives on */
+    if (soak) {
+	eval_mm_soak(tracefiles, num_tracefiles, mm_stats, soak);
 	printf("\n");
     }
 
@@ -329,6 +954,7 @@ int main(int argc, char **argv)
 	    numcorrect++;
     }
     avg_mm_util = util/num_tracefiles;
+    avg_mm_throughput = 0;
 
     /* 
      * Compute and print the performance index 
@@ -337,15 +963,28 @@ int main(int argc, char **argv)
 	avg_mm_throughput = ops/secs;
 
 	p1 = UTIL_WEIGHT * avg_mm_util;
-	if (avg_mm_throughput > AVG_LIBC_THRUPUT) {
+	thru_cap = (libc_thruput > 0) ? libc_thruput : AVG_LIBC_THRUPUT;
+	if (suite) {
+	    /* Each trace's throughput is capped at libc's on it */
+	    p2 = 0;
+	    for (i=0; i < num_tracefiles; i++)
+		p2 += fmin(1.0, (mm_stats[i].ops/mm_stats[i].secs) /
+			   (libc_stats[i].ops/libc_stats[i].secs));
+	    p2 *= (1.0 - UTIL_WEIGHT) / num_tracefiles;
+	}
+	else if (avg_mm_throughput > thru_cap) {
 	    p2 = (double)(1.0 - UTIL_WEIGHT);
 	} 
 	else {
 	    p2 = ((double) (1.0 - UTIL_WEIGHT)) * 
-		(avg_mm_throughput/AVG_LIBC_THRUPUT);
+		(avg_mm_throughput/thru_cap);
 	}
 	
 	perfindex = (p1 + p2)*100.0;
+	if (verbose && !suite)
+	    printf("Throughput cap = %.0f Kops/sec (%s)\n", thru_cap/1e3,
+		   (libc_thruput > 0) ? "libc malloc on this host" :
+		   "AVG_LIBC_THRUPUT");
 	printf("Perf index = %.0f (util) + %.0f (thru) = %.0f/100\n",
 	       p1*100, 
 	       p2*100, 
@@ -362,28 +1001,177 @@ int main(int argc, char **argv)
 	printf("perfidx:%.0f\n", perfindex);
     }
 
+    if (json_path)
+	write_results(json_path, 1, tracefiles, num_tracefiles, mm_stats,
+		      nsys, sys, sys_stats, libc_thruput, &opts, numcorrect,
+		      avg_mm_util, avg_mm_throughput, perfindex);
+    if (csv_path)
+	write_results(csv_path, 0, tracefiles, num_tracefiles, mm_stats,
+		      nsys, sys, sys_stats, libc_thruput, &opts, numcorrect,
+		      avg_mm_util, avg_mm_throughput, perfindex);
+
+    for (i = 1; i < nsys; i++)
+	sysalloc_unload(&sys[i]);
+
     exit(0);
 }
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks. Live
+ * payloads never overlap, so the tree is ordered by low address and
+ * each check or update takes O(log n) time.
  ****************************************************************/
 
+/*
+ * range_height, range_fix, range_rotate_left, range_rotate_right,
+ * range_balance - AVL tree plumbing. range_balance restores the 
+ *     balance of subtree p after an insertion or deletion below it 
+ *     and returns the new root of the subtree.
+ */
+static int range_height(range_t *p)
+{
+    return (p == NULL) ? 0 : p->height;
+}
+
+static void range_fix(range_t *p)
+{
+    int hl = range_height(p->left);
+    int hr = range_height(p->right);
+
+    p->height = ((hl > hr) ? hl : hr) + 1;
+}
+
+static range_t *range_rotate_right(range_t *p)
+{
+    range_t *q = p->left;
+
+    p->left = q->right;
+    q->right = p;
+    range_fix(p);
+    range_fix(q);
+    return q;
+}
+
+static range_t *range_rotate_left(range_t *p)
+{
+    range_t *q = p->right;
+
+    p->right = q->left;
+    q->left = p;
+    range_fix(p);
+    range_fix(q);
+    return q;
+}
+
+static range_t *range_balance(range_t *p)
+{
+    range_fix(p);
+    if (range_height(p->left) - range_height(p->right) > 1) {
+	if (range_height(p->left->right) > range_height(p->left->left))
+	    p->left = range_rotate_left(p->left);
+	return range_rotate_right(p);
+    }
+    if (range_height(p->right) - range_height(p->left) > 1) {
+	if (range_height(p->right->left) > range_height(p->right->right))
+	    p->right = range_rotate_right(p->right);
+	return range_rotate_left(p);
+    }
+    return p;
+}
+
+/*
+ * range_insert - insert record r into subtree p, returning its new root
+ */
+static range_t *range_insert(range_t *p, range_t *r)
+{
+    if (p == NULL)
+	return r;
+    if (r->lo < p->lo)
+	p->left = range_insert(p->left, r);
+    else
+	p->right = range_insert(p->right, r);
+    return range_balance(p);
+}
+
+/*
+ * range_unlink_min - detach the lowest record of subtree p into *min,
+ *     returning the new root of the subtree
+ */
+static range_t *range_unlink_min(range_t *p, range_t **min)
+{
+    if (p->left == NULL) {
+	*min = p;
+	return p->right;
+    }
+    p->left = range_unlink_min(p->left, min);
+    return range_balance(p);
+}
+
+/*
+ * range_delete - delete the record starting at lo from subtree p, 
+ *     recycling it, and return the new root of the subtree
+ */
+static range_t *range_delete(range_t *p, char *lo)
+{
+    range_t *min;
+
+    if (p == NULL)
+	return NULL;
+    if (lo < p->lo)
+	p->left = range_delete(p->left, lo);
+    else if (lo > p->lo)
+	p->right = range_delete(p->right, lo);
+    else {
+	if (p->right == NULL) {
+	    min = p->left;
+	}
+	else {
+	    p->right = range_unlink_min(p->right, &min);
+	    min->left = p->left;
+	    min->right = p->right;
+	}
+	p->left = free_ranges;
+	free_ranges = p;
+	return (min == NULL) ? NULL : range_balance(min);
+    }
+    return range_balance(p);
+}
+
+/*
+ * range_floor - return the record with the highest low address that 
+ *     is <= addr, or NULL if there is none
+ */
+static range_t *range_floor(range_t *p, char *addr)
+{
+    range_t *best = NULL;
+
+    while (p != NULL) {
+	if (p->lo <= addr) {
+	    best = p;
+	    p = p->right;
+	}
+	else 
+	    p = p->left;
+    }
+    return best;
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we create a range struct for this block and add it to the range tree. 
  */
-static int add_range(range_t **ranges, char *lo, int size, 
-		     int tracenum, int opnum)
+static int add_range(range_t **ranges, char *lo, size_t size, 
+		     int tracenum, uint64_t opnum)
 {
     char *hi = lo + size - 1;
     range_t *p;
     char msg[MAXLINE];
+    int i;
 
     assert(size > 0);
 
@@ -396,35 +1184,46 @@ static int add_range(range_t **ranges, char *lo, int size,
     }
 
     /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    if ((lo < (char *)engine->mem_heap_lo()) || (lo > (char *)engine->mem_heap_hi()) || 
+	(hi < (char *)engine->mem_heap_lo()) || (hi > (char *)engine->mem_heap_hi())) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
-		lo, hi, mem_heap_lo(), mem_heap_hi());
+		lo, hi, engine->mem_heap_lo(), engine->mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    /* 
+     * The payload must not overlap any other payloads. Since those
+     * are disjoint, only the last one starting at or below hi can.
+     */
+    p = range_floor(*ranges, hi);
+    if (p != NULL && p->hi >= lo) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by taking a range struct from the pool and adding it the range 
+     * tree. The pool is refilled from libc RANGECHUNK records at a time.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-	unix_error("malloc error in add_range");
-    p->next = *ranges;
+    if (free_ranges == NULL) {
+	if ((p = (range_t *)malloc(RANGECHUNK * sizeof(range_t))) == NULL)
+	    unix_error("malloc error in add_range");
+	for (i = 0; i < RANGECHUNK; i++) {
+	    p[i].left = free_ranges;
+	    free_ranges = &p[i];
+	}
+    }
+    p = free_ranges;
+    free_ranges = p->left;
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    p->left = p->right = NULL;
+    p->height = 1;
+    *ranges = range_insert(*ranges, p);
     return 1;
 }
 
@@ -433,19 +1232,7 @@ static int add_range(range_t **ranges, char *lo, int size,
  */
 static void remove_range(range_t **ranges, char *lo)
 {
-    range_t *p;
-    range_t **prevpp = ranges;
-    int size;
-
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
-    }
+    *ranges = range_delete(*ranges, lo);
 }
 
 /*
@@ -453,52 +1240,174 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    range_t *p = *ranges;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
+    if (p == NULL)
+	return;
+    clear_ranges(&p->left);
+    clear_ranges(&p->right);
+    p->left = free_ranges;
+    free_ranges = p;
     *ranges = NULL;
 }
 
 
-/**********************************************
- * The following routines manipulate tracefiles
- *********************************************/
+/*****************************************************************
+ * The following routines manipulate the id map, a linear-probing
+ * hash table from trace id to live block used when streaming. It
+ * doubles whenever it becomes half full, and deletions shift later
+ * entries of the probe run back instead of leaving tombstones, so
+ * lookups stay short however long the trace runs.
+ ****************************************************************/
+
+#define IDHASH(index) ((size_t)((index) ^ ((index) >> 32)) * 2654435761u)
 
 /*
- * read_trace - read a trace file and store it in memory
+ * idmap_init - start an empty id map
  */
-static trace_t *read_trace(char *tracedir, char *filename)
+static void idmap_init(idmap_t *map)
 {
-    FILE *tracefile;
-    trace_t *trace;
-    char type[MAXLINE];
-    char path[MAXLINE];
-    unsigned index, size;
-    unsigned max_index = 0;
-    unsigned op_index;
+    size_t i;
 
-    if (verbose > 1)
-	printf("Reading tracefile: %s\n", filename);
+    if ((map->slots = malloc(IDMAP_MIN * sizeof(idslot_t))) == NULL)
+	unix_error("malloc failed in idmap_init");
+    map->mask = IDMAP_MIN - 1;
+    map->live = 0;
+    for (i = 0; i <= map->mask; i++)
+	map->slots[i].index = NO_ID;
+}
 
-    /* Allocate the trace record */
-    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
-	unix_error("malloc 1 failed in read_trance");
-	
-    /* Read the trace file header */
-    strcpy(path, tracedir);
-    strcat(path, filename);
-    if ((tracefile = fopen(path, "r")) == NULL) {
-	sprintf(msg, "Could not open %s in read_trace", path);
-	unix_error(msg);
+/*
+ * idmap_find - return the slot holding the block with this id, or
+ *    NULL if no such block is live
+ */
+static idslot_t *idmap_find(idmap_t *map, uint64_t index)
+{
+    size_t i = IDHASH(index) & map->mask;
+
+    while (map->slots[i].index != NO_ID) {
+	if (map->slots[i].index == index)
+	    return &map->slots[i];
+	i = (i + 1) & map->mask;
+    }
+    return NULL;
+}
+
+/*
+ * idmap_insert - record the block with this id, replacing any
+ *    earlier block with the same id
+ */
+static void idmap_insert(idmap_t *map, uint64_t index, char *p, size_t size)
+{
+    idslot_t *old;
+    size_t i, oldmask;
+
+    /* Keep the table at most half full */
+    if (2 * (map->live + 1) > map->mask + 1) {
+	old = map->slots;
+	oldmask = map->mask;
+	map->mask = 2 * oldmask + 1;
+	if ((map->slots = malloc((map->mask + 1) * sizeof(idslot_t))) == NULL)
+	    unix_error("malloc failed in idmap_insert");
+	for (i = 0; i <= map->mask; i++)
+	    map->slots[i].index = NO_ID;
+	map->live = 0;
+	for (i = 0; i <= oldmask; i++)
+	    if (old[i].index != NO_ID)
+		idmap_insert(map, old[i].index, old[i].p, old[i].size);
+	free(old);
+    }
+
+    i = IDHASH(index) & map->mask;
+    while (map->slots[i].index != NO_ID && map->slots[i].index != index)
+	i = (i + 1) & map->mask;
+    if (map->slots[i].index == NO_ID)
+	map->live++;
+    map->slots[i].index = index;
+    map->slots[i].p = p;
+    map->slots[i].size = size;
+}
+
+/*
+ * idmap_delete - remove a slot returned by idmap_find
+ */
+static void idmap_delete(idmap_t *map, idslot_t *slot)
+{
+    size_t hole = slot - map->slots;
+    size_t i = hole;
+    size_t home;
+
+    /* 
+     * Move back any later entry of the probe run whose home slot
+     * doesn't lie cyclically in (hole, i], so it stays reachable
+     */
+    for (;;) {
+	i = (i + 1) & map->mask;
+	if (map->slots[i].index == NO_ID)
+	    break;
+	home = IDHASH(map->slots[i].index) & map->mask;
+	if (((i - home) & map->mask) >= ((i - hole) & map->mask)) {
+	    map->slots[hole] = map->slots[i];
+	    hole = i;
+	}
+    }
+    map->slots[hole].index = NO_ID;
+    map->live--;
+}
+
+/*
+ * idmap_free - release the id map
+ */
+static void idmap_free(idmap_t *map)
+{
+    free(map->slots);
+    map->slots = NULL;
+}
+
+/**********************************************
+ * The following routines manipulate tracefiles
+ *********************************************/
+
+/*
+ * read_trace - read a trace file and store it in memory. Exits if the
+ *     trace, or any request in it, is too big for this build.
+ */
+static trace_t *read_trace(char *tracedir, char *filename)
+{
+    tracefile_t tracefile;
+    trace_t *trace;
+    traceop_t op;
+    char path[MAXLINE];
+    uint64_t max_index = 0;
+    size_t op_index;
+    int rc;
+
+    if (verbose > 1)
+	printf("Reading tracefile: %s\n", filename);
+
+    /* Allocate the trace record */
+    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
+	unix_error("malloc 1 failed in read_trance");
+	
+    /* Read the trace file header, in whichever format the file is in */
+    strcpy(path, tracedir);
+    strcat(path, filename);
+    if (tracefile_open(path, &tracefile) < 0) {
+	sprintf(msg, "%s in read_trace", tracefile.errmsg);
+	app_error(msg);
     }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%d", &(trace->num_ids));     
-    fscanf(tracefile, "%d", &(trace->num_ops));     
-    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
+    if (tracefile.num_ops > SIZE_MAX / sizeof(traceop_t) ||
+	tracefile.num_ids > SIZE_MAX / sizeof(char *)) {
+	printf("Tracefile %s has too many requests (%llu) or ids (%llu)"
+	       " to load\n", path, (unsigned long long)tracefile.num_ops,
+	       (unsigned long long)tracefile.num_ids);
+	exit(1);
+    }
+    trace->sugg_heapsize = tracefile.sugg_heapsize; /* not used */
+    trace->num_ids = (size_t)tracefile.num_ids;
+    trace->num_ops = (size_t)tracefile.num_ops;
+    trace->weight = tracefile.weight;               /* not used */
+    trace->num_threads = 1;
     
     /* We'll store each request line in the trace in this array */
     if ((trace->ops = 
@@ -515,39 +1424,37 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
 	unix_error("malloc 4 failed in read_trace");
     
-    /* read every request line in the trace file */
-    index = 0;
+    /* read every request in the trace file */
     op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-	switch(type[0]) {
-	case 'a':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = ALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'r':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = REALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'f':
-	    fscanf(tracefile, "%ud", &index);
-	    trace->ops[op_index].type = FREE;
-	    trace->ops[op_index].index = index;
-	    break;
-	default:
-	    printf("Bogus type character (%c) in tracefile %s\n", 
-		   type[0], path);
+    while ((rc = tracefile_next(&tracefile, &op)) > 0) {
+	if (op_index >= trace->num_ops) {
+	    printf("More requests than the header's %llu in tracefile %s\n",
+		   (unsigned long long)trace->num_ops, path);
 	    exit(1);
 	}
-	op_index++;
-	
+	if (op.type != BARRIER && op.index >= trace->num_ids) {
+	    printf("Request %llu has id %llu, beyond the header's %llu ids,"
+		   " in tracefile %s\n", (unsigned long long)op_index,
+		   (unsigned long long)op.index,
+		   (unsigned long long)trace->num_ids, path);
+	    exit(1);
+	}
+	if (op.size > SIZE_MAX) {
+	    printf("Request %llu asks for %llu bytes, more than a size_t holds,"
+		   " in tracefile %s\n", (unsigned long long)op_index,
+		   (unsigned long long)op.size, path);
+	    exit(1);
+	}
+	trace->ops[op_index++] = op;
+	if (op.type == ALLOC || op.type == REALLOC)
+	    max_index = (op.index > max_index) ? op.index : max_index;
     }
-    fclose(tracefile);
+    if (rc < 0) {
+	printf("%s in tracefile %s\n", tracefile.errmsg, path);
+	exit(1);
+    }
+    trace->num_threads = tracefile.num_threads;
+    tracefile_close(&tracefile);
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
     
@@ -576,20 +1483,20 @@ void free_trace(trace_t *trace)
  */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
 {
-    int i, j;
-    int index;
-    int size;
-    int oldsize;
+    size_t i, j;
+    size_t index;
+    size_t size;
+    size_t oldsize;
     char *newp;
     char *oldp;
     char *p;
     
     /* Reset the heap and free any records in the range list */
-    mem_reset_brk();
+    engine->mem_reset_brk();
     clear_ranges(ranges);
 
     /* Call the mm package's init function */
-    if (mm_init() < 0) {
+    if (engine->mm_init() < 0) {
 	malloc_error(tracenum, 0, "mm_init failed.");
 	return 0;
     }
@@ -604,7 +1511,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         case ALLOC: /* mm_malloc */
 
 	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
+	    if ((p = engine->mm_malloc(size)) == NULL) {
 		malloc_error(tracenum, i, "mm_malloc failed.");
 		return 0;
 	    }
@@ -633,7 +1540,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    /* Call the student's realloc */
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp, size)) == NULL) {
+	    if ((newp = engine->mm_realloc(oldp, size)) == NULL) {
 		malloc_error(tracenum, i, "mm_realloc failed.");
 		return 0;
 	    }
@@ -653,7 +1560,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -671,7 +1578,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    /* Remove region from list and call student's free function */
 	    p = trace->blocks[index];
 	    remove_range(ranges, p);
-	    mm_free(p);
+	    engine->mm_free(p);
+	    break;
+
+	case BARRIER: /* only matters when replaying threads */
 	    break;
 
 	default:
@@ -693,21 +1603,25 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   package on the trace. Note that our implementation of mem_sbrk() 
  *   doesn't allow the students to decrement the brk pointer, so brk
  *   is always the high water mark of the heap. 
- *   
+ *
+ *   If resident is not NULL, the peak of the heap's resident bytes
+ *   over the run is left there.
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   double *resident)
 {   
-    int i;
-    int index;
-    int size, newsize, oldsize;
-    int max_total_size = 0;
-    int total_size = 0;
+    size_t i;
+    size_t heap = 0;
+    size_t index;
+    size_t size, newsize, oldsize;
+    uint64_t max_total_size = 0;
+    uint64_t total_size = 0;
     char *p;
     char *newp, *oldp;
 
     /* initialize the heap and the mm malloc package */
-    mem_reset_brk();
-    if (mm_init() < 0)
+    engine->mem_reset_brk();
+    if (engine->mm_init() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -717,7 +1631,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if ((p = engine->mm_malloc(size)) == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -739,7 +1653,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp,newsize)) == NULL)
+	    if ((newp = engine->mm_realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc failed in eval_mm_util");
 
 	    /* Remember region and size */
@@ -748,7 +1662,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
-	    total_size += (newsize - oldsize);
+	    total_size = total_size - oldsize + newsize;
 	    
 	    /* Update statistics */
 	    max_total_size = (total_size > max_total_size) ?
@@ -760,7 +1674,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
-	    mm_free(p);
+	    engine->mm_free(p);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -768,13 +1682,37 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    break;
 
+	case BARRIER: /* only matters when replaying threads */
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
+	if (resident)
+	    sample_resident(i, &heap, resident);
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)engine->mem_heapsize());
+}
+
+/*
+ * sample_resident - Count the heap's resident bytes into *peak, if
+ *    they are more, when the heap has grown past *heap since the last
+ *    count or every RESIDENT_EVERY requests. The peak is what the
+ *    package needed of physical memory, whatever it gave back later.
+ */
+static void sample_resident(uint64_t opnum, size_t *heap, double *peak)
+{
+    size_t now = engine->mem_heapsize();
+    double bytes;
+
+    if (now <= *heap && opnum % RESIDENT_EVERY != 0)
+	return;
+    *heap = now;
+    bytes = (double)engine->mem_resident_pages() * mem_pagesize();
+    if (bytes > *peak)
+	*peak = bytes;
 }
 
 
@@ -784,13 +1722,13 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
+    size_t i, index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
     /* Reset the heap and initialize the mm package */
-    mem_reset_brk();
-    if (mm_init() < 0) 
+    engine->mem_reset_brk();
+    if (engine->mm_init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
@@ -800,7 +1738,7 @@ static void eval_mm_speed(void *ptr)
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = engine->mm_malloc(size)) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
@@ -809,7 +1747,7 @@ static void eval_mm_speed(void *ptr)
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL)
+            if ((newp = engine->mm_realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
             break;
@@ -817,159 +1755,2358 @@ static void eval_mm_speed(void *ptr)
         case FREE: /* mm_free */
             index = trace->ops[i].index;
             block = trace->blocks[index];
-            mm_free(block);
+            engine->mm_free(block);
             break;
 
+	case BARRIER: /* only matters when replaying threads */
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 }
 
 /*
- * eval_libc_valid - We run this function to make sure that the
- *    libc malloc can run to completion on the set of traces.
- *    We'll be conservative and terminate if any libc malloc call fails.
- *
+ * stream_error - Report a malformed trace found while streaming
  */
-static int eval_libc_valid(trace_t *trace, int tracenum)
+static void stream_error(tracestream_t *ts, char *path)
+{
+    printf("%s in tracefile %s\n", ts->tf.errmsg, path);
+    exit(1);
+}
+
+/*
+ * eval_mm_stream_valid - Check the mm malloc package for correctness
+ *    on a trace streamed from disk, measuring its space utilization
+ *    on the same pass. Only the live blocks are held in memory.
+ */
+static int eval_mm_stream_valid(char *path, int tracenum, range_t **ranges,
+				double *util, double *ops, double *resident)
 {
-    int i, newsize;
+    tracestream_t ts;
+    traceop_t *window;
+    idmap_t map;
+    idslot_t *slot;
+    int i, n;
+    uint64_t opnum = 0, index;
+    size_t j, size, oldsize;
+    uint64_t total_size = 0, max_total_size = 0;
+    size_t heap = 0;
     char *p, *newp, *oldp;
+    int valid = 0;
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    if (tracestream_open(path, STREAM_WINDOW, &ts) < 0) {
+	sprintf(msg, "%s in eval_mm_stream_valid", ts.tf.errmsg);
+	app_error(msg);
+    }
+    *ops = ts.tf.num_ops;
+    idmap_init(&map);
 
-        case ALLOC: /* malloc */
-	    if ((p = malloc(trace->ops[i].size)) == NULL) {
-		malloc_error(tracenum, i, "libc malloc failed");
-		unix_error("System message");
+    /* Reset the heap and free any records in the range list */
+    engine->mem_reset_brk();
+    clear_ranges(ranges);
+
+    /* Call the mm package's init function */
+    if (engine->mm_init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	goto out;
+    }
+
+    /* Interpret each operation in the trace in order */
+    while ((n = tracestream_next(&ts, &window)) > 0) {
+	for (i = 0; i < n; i++, opnum++) {
+	    if (window[i].size > SIZE_MAX) {
+		printf("Request %llu asks for %llu bytes, more than a size_t"
+		       " holds, in tracefile %s\n", (unsigned long long)opnum,
+		       (unsigned long long)window[i].size, path);
+		exit(1);
 	    }
-	    trace->blocks[trace->ops[i].index] = p;
-	    break;
+	    index = window[i].index;
+	    size = window[i].size;
 
-	case REALLOC: /* realloc */
-            newsize = trace->ops[i].size;
-	    oldp = trace->blocks[trace->ops[i].index];
-	    if ((newp = realloc(oldp, newsize)) == NULL) {
-		malloc_error(tracenum, i, "libc realloc failed");
-		unix_error("System message");
+	    switch (window[i].type) {
+
+	    case ALLOC: /* mm_malloc */
+		if ((p = engine->mm_malloc(size)) == NULL) {
+		    malloc_error(tracenum, opnum, "mm_malloc failed.");
+		    goto out;
+		}
+		if (add_range(ranges, p, size, tracenum, opnum) == 0)
+		    goto out;
+		memset(p, index & 0xFF, size);
+		idmap_insert(&map, index, p, size);
+		total_size += size;
+		break;
+
+	    case REALLOC: /* mm_realloc */
+		if ((slot = idmap_find(&map, index)) == NULL) {
+		    sprintf(msg, "Realloc of id %llu, which is not live, in tracefile %s",
+			    (unsigned long long)index, path);
+		    app_error(msg);
+		}
+		oldp = slot->p;
+		if ((newp = engine->mm_realloc(oldp, size)) == NULL) {
+		    malloc_error(tracenum, opnum, "mm_realloc failed.");
+		    goto out;
+		}
+		remove_range(ranges, oldp);
+		if (add_range(ranges, newp, size, tracenum, opnum) == 0)
+		    goto out;
+
+		/* The old data must have been copied to the new block */
+		oldsize = slot->size;
+		if (size < oldsize) oldsize = size;
+		for (j = 0; j < oldsize; j++) {
+		    if ((unsigned char)newp[j] != (index & 0xFF)) {
+			malloc_error(tracenum, opnum, "mm_realloc did not preserve the "
+				     "data from old block");
+			goto out;
+		    }
+		}
+		memset(newp, index & 0xFF, size);
+		total_size = total_size - slot->size + size;
+		slot->p = newp;
+		slot->size = size;
+		break;
+
+	    case FREE: /* mm_free */
+		if ((slot = idmap_find(&map, index)) == NULL) {
+		    sprintf(msg, "Free of id %llu, which is not live, in tracefile %s",
+			    (unsigned long long)index, path);
+		    app_error(msg);
+		}
+		remove_range(ranges, slot->p);
+		engine->mm_free(slot->p);
+		total_size -= slot->size;
+		idmap_delete(&map, slot);
+		break;
+
+	    case BARRIER: /* only matters when replaying threads */
+		break;
+
+	    default:
+		app_error("Nonexistent request type in eval_mm_stream_valid");
 	    }
-	    trace->blocks[trace->ops[i].index] = newp;
-	    break;
-	    
-        case FREE: /* free */
-	    free(trace->blocks[trace->ops[i].index]);
-	    break;
 
-	default:
-	    app_error("invalid operation type  in eval_libc_valid");
+	    if (total_size > max_total_size)
+		max_total_size = total_size;
+	    sample_resident(opnum, &heap, resident);
 	}
     }
+    if (n < 0)
+	stream_error(&ts, path);
+    if (opnum != ts.tf.num_ops) {
+	printf("Found %llu requests, not the header's %llu, in tracefile %s\n",
+	       (unsigned long long)opnum, (unsigned long long)ts.tf.num_ops, path);
+	exit(1);
+    }
 
-    return 1;
+    /* As far as we know, this is a valid malloc package */
+    *util = (double)max_total_size / (double)engine->mem_heapsize();
+    valid = 1;
+
+ out:
+    idmap_free(&map);
+    tracestream_close(&ts);
+    return valid;
 }
 
-/* 
- * eval_libc_speed - This is the function that is used by fcyc() to
- *    measure the running time of the libc malloc package on the set
- *    of traces.
+/*
+ * eval_mm_stream_speed - This is the function that is used by fcyc()
+ *    to measure the running time of the mm malloc package when the
+ *    trace is streamed. Each run reads the trace again.
  */
-static void eval_libc_speed(void *ptr)
+static void eval_mm_stream_speed(void *ptr)
 {
-    int i;
-    int index, size, newsize;
-    char *p, *newp, *oldp, *block;
-    trace_t *trace = ((speed_t *)ptr)->trace;
+    char *path = ((speed_t *)ptr)->path;
+    tracestream_t ts;
+    traceop_t *window;
+    idmap_t map;
+    idslot_t *slot;
+    int i, n;
+    char *p;
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
-        case ALLOC: /* malloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
-	    if ((p = malloc(size)) == NULL)
-		unix_error("malloc failed in eval_libc_speed");
-	    trace->blocks[index] = p;
-	    break;
+    if (tracestream_open(path, STREAM_WINDOW, &ts) < 0)
+	app_error("tracestream_open failed in eval_mm_stream_speed");
+    idmap_init(&map);
 
-	case REALLOC: /* realloc */
-	    index = trace->ops[i].index;
-	    newsize = trace->ops[i].size;
-	    oldp = trace->blocks[index];
-	    if ((newp = realloc(oldp, newsize)) == NULL)
-		unix_error("realloc failed in eval_libc_speed\n");
-	    
-	    trace->blocks[index] = newp;
-	    break;
-	    
-        case FREE: /* free */
-	    index = trace->ops[i].index;
-	    block = trace->blocks[index];
-	    free(block);
-	    break;
-	}
-    }
+    /* Reset the heap and initialize the mm package */
+    engine->mem_reset_brk();
+    if (engine->mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_stream_speed");
+
+    /* Interpret each trace request */
+    while ((n = tracestream_next(&ts, &window)) > 0)
+	for (i = 0; i < n; i++)
+	    switch (window[i].type) {
+
+	    case ALLOC: /* mm_malloc */
+		if ((p = engine->mm_malloc(window[i].size)) == NULL)
+		    app_error("mm_malloc error in eval_mm_stream_speed");
+		idmap_insert(&map, window[i].index, p, window[i].size);
+		break;
+
+	    case REALLOC: /* mm_realloc */
+		slot = idmap_find(&map, window[i].index);
+		if ((p = engine->mm_realloc(slot->p, window[i].size)) == NULL)
+		    app_error("mm_realloc error in eval_mm_stream_speed");
+		slot->p = p;
+		break;
+
+	    case FREE: /* mm_free */
+		slot = idmap_find(&map, window[i].index);
+		engine->mm_free(slot->p);
+		idmap_delete(&map, slot);
+		break;
+
+	    case BARRIER: /* only matters when replaying threads */
+		break;
+
+	    default:
+		app_error("Nonexistent request type in eval_mm_stream_speed");
+	    }
+    if (n < 0)
+	stream_error(&ts, path);
+
+    idmap_free(&map);
+    tracestream_close(&ts);
 }
 
-/*************************************
- * Some miscellaneous helper routines
- ************************************/
+/*
+ * eval_null_stream_speed - The streaming counterpart of
+ *    eval_null_speed: reads and decodes the trace and keeps the id
+ *    map the same way as eval_mm_stream_speed, but makes no
+ *    allocator calls
+ */
+static void eval_null_stream_speed(void *ptr)
+{
+    static char dummy;
+    char *path = ((speed_t *)ptr)->path;
+    tracestream_t ts;
+    traceop_t *window;
+    idmap_t map;
+    idslot_t *slot;
+    int i, n;
+
+    if (tracestream_open(path, STREAM_WINDOW, &ts) < 0)
+	app_error("tracestream_open failed in eval_null_stream_speed");
+    idmap_init(&map);
+
+    engine->mem_reset_brk();
+    while ((n = tracestream_next(&ts, &window)) > 0)
+	for (i = 0; i < n; i++)
+	    switch (window[i].type) {
+	    case ALLOC: /* malloc */
+		idmap_insert(&map, window[i].index, &dummy, window[i].size);
+		break;
+	    case REALLOC: /* realloc */
+		slot = idmap_find(&map, window[i].index);
+		slot->p = &dummy;
+		break;
+	    case FREE: /* free */
+		slot = idmap_find(&map, window[i].index);
+		dummy = *slot->p;
+		idmap_delete(&map, slot);
+		break;
+	    case BARRIER: /* only matters when replaying threads */
+		break;
+	    }
+    if (n < 0)
+	stream_error(&ts, path);
 
+    idmap_free(&map);
+    tracestream_close(&ts);
+}
 
 /*
- * printresults - prints a performance summary for some malloc package
+ * eval_mm_trace - Evaluate the mm malloc package on one trace: check
+ *    it for correctness and, if it passes, measure its space 
+ *    utilization and throughput
  */
-static void printresults(int n, stats_t *stats) 
+static void eval_mm_trace(char *filename, int tracenum, evalopts_t *opts,
+			  range_t **ranges, stats_t *stats)
 {
-    int i;
-    double secs = 0;
-    double ops = 0;
-    double util = 0;
+    trace_t *trace;
+    speed_t speed_params;
+    char path[MAXLINE];
 
-    /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
-	   "trace", " valid", "util", "ops", "secs", "Kops");
-    for (i=0; i < n; i++) {
-	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
-		   i,
-		   "yes",
-		   stats[i].util*100.0,
-		   stats[i].ops,
-		   stats[i].secs,
-		   (stats[i].ops/1e3)/stats[i].secs);
-	    secs += stats[i].secs;
-	    ops += stats[i].ops;
-	    util += stats[i].util;
-	}
-	else {
-	    printf("%2d%10s%6s%8s%10s%6s\n", 
-		   i,
-		   "no",
-		   "-",
-		   "-",
-		   "-",
-		   "-");
+    if (opts->stream) {
+	strcpy(path, tracedir);
+	strcat(path, filename);
+	if (verbose > 1)
+	    printf("Streaming tracefile: %s\n"
+		   "Checking mm_malloc for correctness and efficiency, ",
+		   filename);
+	engine->mem_reset_heap();
+	stats->valid = eval_mm_stream_valid(path, tracenum, ranges,
+					    &stats->util, &stats->ops,
+					    &stats->resident);
+	if (stats->valid) {
+	    stats->heap = engine->mem_heapsize();
+	    speed_params.path = path;
+	    if (verbose > 1)
+		printf("and performance.\n");
+	    stats->secs = fsecs_less(eval_mm_stream_speed,
+				     eval_null_stream_speed, &speed_params,
+				     &stats->ci);
+
+	    /* On a short trace the reader thread's start-up can swamp
+	       mm's share; then report the two together, as an upper
+	       bound, rather than a time that may not even be positive */
+	    if (stats->secs <= stats->ci) {
+		if (verbose)
+		    printf("Trace %d: mm's time is lost in the streaming "
+			   "overhead, reporting both.\n", tracenum);
+		stats->secs = fsecs_ci(eval_mm_stream_speed, &speed_params,
+				       &stats->ci);
+	    }
 	}
+	return;
     }
 
-    /* Print the aggregate results for the set of traces */
-    if (errors == 0) {
-	printf("%12s%5.0f%%%8.0f%10.6f%6.0f\n", 
-	       "Total       ",
-	       (util/n)*100.0,
-	       ops, 
-	       secs,
-	       (ops/1e3)/secs);
+    trace = read_trace(tracedir, filename);
+    stats->ops = trace->num_ops;
+    if (verbose > 1)
+	printf("Checking mm_malloc for correctness, ");
+    engine->mem_reset_heap();
+    stats->valid = eval_mm_valid(trace, tracenum, ranges);
+    if (stats->valid) {
+	if (verbose > 1)
+	    printf("efficiency, ");
+	engine->mem_reset_heap();
+	stats->util = eval_mm_util(trace, tracenum, ranges, &stats->resident);
+	stats->heap = engine->mem_heapsize();
+	speed_params.trace = trace;
+	speed_params.ranges = *ranges;
+	if (verbose > 1)
+	    printf("and performance.\n");
+	stats->secs = fsecs_less(eval_mm_speed, eval_null_speed,
+				 &speed_params, &stats->ci);
+	if (opts->latency)
+	    eval_mm_latency(trace, stats);
+	if (opts->counters)
+	    eval_mm_counters(trace, stats);
+	if (opts->startup)
+	    eval_mm_startup(trace, opts->startup, stats);
+	if (opts->touch)
+	    eval_mm_touch(trace, opts->touch, stats);
+	if (opts->locality)
+	    eval_mm_locality(trace, stats);
     }
-    else {
-	printf("%12s%6s%8s%10s%6s\n", 
-	       "Total       ",
-	       "-", 
-	       "-", 
-	       "-", 
-	       "-");
+    free_trace(trace);
+}
+
+/*
+ * eval_mm_parallel - Evaluate the traces in up to jobs forked workers
+ *    at a time. Each worker runs one trace on its own copy of the
+ *    simulated heap and sends its stats back over a pipe, so a worker
+ *    that crashes only costs its own trace. If pin is set, each
+ *    running worker is bound to a different core.
+ */
+static void eval_mm_parallel(char **tracefiles, int num_tracefiles,
+			     evalopts_t *opts, int jobs, int pin, stats_t *stats)
+{
+    worker_t *workers;
+    result_t result;
+    range_t *ranges = NULL;
+    cpu_set_t cpus, set;
+    int *cpu = NULL;     /* the cores we may run on, in order */
+    int ncpus = 0;
+    int next = 0, running = 0;
+    int i, s, fds[2], status, got;
+    pid_t pid;
+
+    if ((workers = (worker_t *)calloc(jobs, sizeof(worker_t))) == NULL)
+	unix_error("workers calloc in eval_mm_parallel failed");
+
+    /* Hand out the cores we are allowed on, one per worker slot */
+    if (pin) {
+	if (sched_getaffinity(0, sizeof(cpus), &cpus) < 0)
+	    unix_error("sched_getaffinity failed in eval_mm_parallel");
+	if ((cpu = (int *)malloc(CPU_SETSIZE * sizeof(int))) == NULL)
+	    unix_error("malloc failed in eval_mm_parallel");
+	for (i = 0; i < CPU_SETSIZE; i++)
+	    if (CPU_ISSET(i, &cpus))
+		cpu[ncpus++] = i;
+	if (jobs > ncpus)
+	    printf("Warning: %d workers share %d cores\n", jobs, ncpus);
+    }
+
+    while (next < num_tracefiles || running > 0) {
+
+	/* Start workers until every slot is busy */
+	for (s = 0; s < jobs && next < num_tracefiles; s++) {
+	    if (workers[s].pid != 0)
+		continue;
+	    if (pipe(fds) < 0)
+		unix_error("pipe failed in eval_mm_parallel");
+	    fflush(stdout); /* or the child would print it again */
+	    if ((pid = fork()) < 0)
+		unix_error("fork failed in eval_mm_parallel");
+
+	    if (pid == 0) {
+		close(fds[0]);
+		if (pin) {
+		    CPU_ZERO(&set);
+		    CPU_SET(cpu[s % ncpus], &set);
+		    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+			unix_error("sched_setaffinity failed in eval_mm_parallel");
+		}
+		memset(&result, 0, sizeof(result));
+		errors = 0;
+		eval_mm_trace(tracefiles[next], next, opts, &ranges, 
+			      &result.stats);
+		result.errors = errors;
+		if (write(fds[1], &result, sizeof(result)) != sizeof(result))
+		    exit(1);
+		exit(0);
+	    }
+
+	    close(fds[1]);
+	    workers[s].pid = pid;
+	    workers[s].fd = fds[0];
+	    workers[s].tracenum = next++;
+	    running++;
+	}
+
+	/* Collect whichever worker finishes first */
+	if ((pid = waitpid(-1, &status, 0)) < 0)
+	    unix_error("waitpid failed in eval_mm_parallel");
+	for (s = 0; s < jobs && workers[s].pid != pid; s++)
+	    ;
+	if (s == jobs)
+	    continue;
+	i = workers[s].tracenum;
+	got = (read(workers[s].fd, &result, sizeof(result)) == sizeof(result));
+	close(workers[s].fd);
+	workers[s].pid = 0;
+	running--;
+
+	if (WIFSIGNALED(status)) {
+	    errors++;
+	    printf("ERROR [trace %d]: worker killed by signal %d (%s)\n",
+		   i, WTERMSIG(status), strsignal(WTERMSIG(status)));
+	}
+	else if (!got || WEXITSTATUS(status) != 0) {
+	    errors++;
+	    printf("ERROR [trace %d]: worker exited with status %d\n",
+		   i, WEXITSTATUS(status));
+	}
+	else {
+	    stats[i] = result.stats;
+	    errors += result.errors;
+	}
     }
 
+    free(cpu);
+    free(workers);
+}
+
+/*
+ * replay_thread - Replay one thread's share of a trace. Requests on
+ *    the same block are made in trace order even when they come from
+ *    different threads: each waits until every earlier request on
+ *    its block has completed.
+ */
+static void *replay_thread(void *arg)
+{
+    replayer_t *r = (replayer_t *)arg;
+    threads_t *t = r->shared;
+    char **blocks = t->trace->blocks;
+    size_t *done = t->done;
+    struct timespec start, end;
+    threadop_t *top;
+    size_t i, index;
+    char *p;
+    double secs;
+
+    pthread_barrier_wait(&t->barrier);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < r->num_ops; i++) {
+	top = &r->ops[i];
+	index = top->op.index;
+	if (top->op.type == BARRIER) {
+	    pthread_barrier_wait(&t->barrier);
+	    continue;
+	}
+
+	while (__atomic_load_n(&done[index], __ATOMIC_ACQUIRE) != top->seq)
+	    sched_yield();
+
+	switch (top->op.type) {
+
+	case ALLOC: /* mm_malloc */
+	    if ((p = engine->mm_malloc(top->op.size)) == NULL)
+		app_error("mm_malloc error in replay_thread");
+	    blocks[index] = p;
+	    break;
+
+	case REALLOC: /* mm_realloc */
+	    if ((p = engine->mm_realloc(blocks[index], top->op.size)) == NULL)
+		app_error("mm_realloc error in replay_thread");
+	    blocks[index] = p;
+	    break;
+
+	case FREE: /* mm_free */
+	    engine->mm_free(blocks[index]);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in replay_thread");
+	}
+
+	__atomic_store_n(&done[index], top->seq + 1, __ATOMIC_RELEASE);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    if (secs < r->secs)
+	r->secs = secs;
+    return NULL;
+}
+
+/*
+ * eval_mm_threads_speed - This is the function that is used by fcyc()
+ *    to measure the running time of the mm malloc package when a
+ *    trace is replayed by several threads at once.
+ */
+static void eval_mm_threads_speed(void *ptr)
+{
+    threads_t *t = (threads_t *)ptr;
+    int w;
+
+    /* Reset the heap and initialize the mm package */
+    engine->mem_reset_brk();
+    if (engine->mm_init() < 0)
+	app_error("mm_init failed in eval_mm_threads_speed");
+    memset(t->done, 0, t->trace->num_ids * sizeof(size_t));
+
+    pthread_barrier_init(&t->barrier, NULL, t->workers);
+    for (w = 0; w < t->workers; w++)
+	if (pthread_create(&t->replayers[w].thread, NULL, replay_thread,
+			   &t->replayers[w]) != 0)
+	    app_error("pthread_create failed in eval_mm_threads_speed");
+    for (w = 0; w < t->workers; w++)
+	pthread_join(t->replayers[w].thread, NULL);
+    pthread_barrier_destroy(&t->barrier);
+}
+
+/*
+ * eval_mm_threads - Replay a trace with each of its threads' requests
+ *    made by a thread of its own, using 1, 2, ... up to max_workers
+ *    replay threads (trace thread i runs on replay thread i % workers),
+ *    and print the throughput at each step.
+ */
+static void eval_mm_threads(trace_t *trace, int tracenum, int max_workers)
+{
+    threads_t t;
+    replayer_t *r;
+    size_t *seq;         /* requests seen so far on each id */
+    size_t i, requests = 0;
+    int w, workers;
+    double secs, base_secs = 0;
+
+    t.trace = trace;
+    if ((t.done = (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL ||
+	(seq = (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL ||
+	(t.replayers = (replayer_t *)calloc(max_workers, 
+					    sizeof(replayer_t))) == NULL)
+	unix_error("malloc failed in eval_mm_threads");
+    for (i = 0; i < trace->num_ops; i++)
+	if (trace->ops[i].type != BARRIER)
+	    requests++;
+
+    printf("\nThreaded replay of trace %d (%d trace threads):\n",
+	   tracenum, trace->num_threads);
+    printf("%7s%10s%8s%8s  %s\n", 
+	   "threads", "secs", "Kops", "speedup", "Kops per thread");
+
+    for (workers = 1; workers <= max_workers && workers <= trace->num_threads;
+	 workers++) {
+	t.workers = workers;
+
+	/* Deal the requests out to the replay threads */
+	for (w = 0; w < workers; w++) {
+	    r = &t.replayers[w];
+	    r->num_ops = r->requests = 0;
+	    r->secs = DBL_MAX;
+	    r->shared = &t;
+	    free(r->ops);
+	    if ((r->ops = (threadop_t *)malloc(trace->num_ops * 
+					       sizeof(threadop_t))) == NULL)
+		unix_error("malloc failed in eval_mm_threads");
+	}
+	memset(seq, 0, trace->num_ids * sizeof(size_t));
+	for (i = 0; i < trace->num_ops; i++) {
+	    if (trace->ops[i].type == BARRIER) {
+		for (w = 0; w < workers; w++)
+		    t.replayers[w].ops[t.replayers[w].num_ops++].op = trace->ops[i];
+		continue;
+	    }
+	    r = &t.replayers[trace->ops[i].tid % workers];
+	    r->ops[r->num_ops].op = trace->ops[i];
+	    r->ops[r->num_ops++].seq = seq[trace->ops[i].index]++;
+	    r->requests++;
+	}
+
+	secs = fsecs(eval_mm_threads_speed, &t);
+	if (workers == 1)
+	    base_secs = secs;
+	printf("%7d%10.6f%8.0f%7.2fx ", 
+	       workers, secs, (requests/1e3)/secs, base_secs/secs);
+	for (w = 0; w < workers; w++)
+	    printf(" %.0f", (t.replayers[w].requests/1e3)/t.replayers[w].secs);
+	printf("\n");
+    }
+
+    for (w = 0; w < max_workers; w++)
+	free(t.replayers[w].ops);
+    free(t.replayers);
+    free(t.done);
+    free(seq);
+}
+
+/*
+ * eval_mm_latency - Replay a trace once more, reading the tick counter
+ *    around every request, and summarize the latencies of each type
+ *    of request in stats->lat. Unlike eval_mm_speed, a single slow
+ *    request shows up here instead of vanishing into the average.
+ */
+static void eval_mm_latency(trace_t *trace, stats_t *stats)
+{
+    static hist_t hists[3];  /* for ALLOC, FREE and REALLOC requests */
+    double ticks_per_ns = hist_ticks_per_ns();
+    uint64_t overhead = hist_ticks_overhead();
+    uint64_t start, ticks;
+    size_t i, index;
+    int type;
+    char *p;
+
+    for (type = 0; type < 3; type++)
+	hist_reset(&hists[type]);
+
+    /* Reset the heap and initialize the mm package */
+    engine->mem_reset_brk();
+    if (engine->mm_init() < 0)
+	app_error("mm_init failed in eval_mm_latency");
+
+    for (i = 0; i < trace->num_ops; i++) {
+	type = trace->ops[i].type;
+	index = trace->ops[i].index;
+
+	switch (type) {
+
+	case ALLOC: /* mm_malloc */
+	    start = hist_ticks();
+	    p = engine->mm_malloc(trace->ops[i].size);
+	    ticks = hist_ticks() - start;
+	    if (p == NULL)
+		app_error("mm_malloc error in eval_mm_latency");
+	    trace->blocks[index] = p;
+	    break;
+
+	case REALLOC: /* mm_realloc */
+	    start = hist_ticks();
+	    p = engine->mm_realloc(trace->blocks[index], trace->ops[i].size);
+	    ticks = hist_ticks() - start;
+	    if (p == NULL)
+		app_error("mm_realloc error in eval_mm_latency");
+	    trace->blocks[index] = p;
+	    break;
+
+	case FREE: /* mm_free */
+	    start = hist_ticks();
+	    engine->mm_free(trace->blocks[index]);
+	    ticks = hist_ticks() - start;
+	    break;
+
+	default: /* barriers take no time */
+	    continue;
+	}
+
+	hist_add(&hists[type], (ticks > overhead) ? ticks - overhead : 0);
+    }
+
+    for (type = 0; type < 3; type++) {
+	stats->lat[type].count = hists[type].count;
+	stats->lat[type].p50 = hist_percentile(&hists[type], 50) / ticks_per_ns;
+	stats->lat[type].p90 = hist_percentile(&hists[type], 90) / ticks_per_ns;
+	stats->lat[type].p99 = hist_percentile(&hists[type], 99) / ticks_per_ns;
+	stats->lat[type].p999 = hist_percentile(&hists[type], 99.9) / ticks_per_ns;
+	stats->lat[type].max = hists[type].max / ticks_per_ns;
+    }
+}
+
+/*
+ * eval_mm_counters - Count the hardware events during one more run of
+ *    eval_mm_speed, take off those of a run of eval_null_speed, and
+ *    store the rest per request in stats->ctr
+ */
+static void eval_mm_counters(trace_t *trace, stats_t *stats)
+{
+    static perfctr_t perfctr;
+    static int opened = 0;
+    double mm[PERFCTR_NUM], null[PERFCTR_NUM];
+    speed_t speed_params;
+    int i;
+
+    /* Opened on first use, so each -j worker has its own */
+    if (!opened) {
+	perfctr_open(&perfctr);
+	opened = 1;
+    }
+
+    speed_params.trace = trace;
+    perfctr_start(&perfctr);
+    eval_mm_speed(&speed_params);
+    perfctr_stop(&perfctr, mm);
+    perfctr_start(&perfctr);
+    eval_null_speed(&speed_params);
+    perfctr_stop(&perfctr, null);
+
+    for (i = 0; i < PERFCTR_NUM; i++) {
+	if (mm[i] < 0 || null[i] < 0)
+	    stats->ctr[i] = -1;
+	else if (mm[i] > null[i])
+	    stats->ctr[i] = (mm[i] - null[i]) / stats->ops;
+	else
+	    stats->ctr[i] = 0;
+    }
+}
+
+/* cmp_double - qsort comparison of two doubles */
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * eval_mm_startup - Time mm_init on a fresh heap and the first n
+ *    requests after it, with the caches flushed just before, and
+ *    store the medians of STARTUP_RUNS runs in stats. This is what a
+ *    short-lived program pays, and eval_mm_speed's warm, repeated
+ *    runs never see it.
+ */
+static void eval_mm_startup(trace_t *trace, int n, stats_t *stats)
+{
+    double ticks_per_ns = hist_ticks_per_ns();
+    double init[STARTUP_RUNS], first[STARTUP_RUNS];
+    uint64_t start, mid, end;
+    size_t i, index, num_ops, requests = 0;
+    int run;
+    char *p;
+
+    num_ops = ((size_t)n < trace->num_ops) ? (size_t)n : trace->num_ops;
+    for (run = 0; run < STARTUP_RUNS; run++) {
+	engine->mem_reset_brk();
+	fsecs_clear_cache();
+
+	start = hist_ticks();
+	if (engine->mm_init() < 0)
+	    app_error("mm_init failed in eval_mm_startup");
+	mid = hist_ticks();
+
+	for (i = 0, requests = 0; i < num_ops; i++) {
+	    index = trace->ops[i].index;
+	    switch (trace->ops[i].type) {
+
+	    case ALLOC: /* mm_malloc */
+		if ((p = engine->mm_malloc(trace->ops[i].size)) == NULL)
+		    app_error("mm_malloc error in eval_mm_startup");
+		trace->blocks[index] = p;
+		break;
+
+	    case REALLOC: /* mm_realloc */
+		p = engine->mm_realloc(trace->blocks[index], trace->ops[i].size);
+		if (p == NULL)
+		    app_error("mm_realloc error in eval_mm_startup");
+		trace->blocks[index] = p;
+		break;
+
+	    case FREE: /* mm_free */
+		engine->mm_free(trace->blocks[index]);
+		break;
+
+	    default: /* barriers are not requests */
+		continue;
+	    }
+	    requests++;
+	}
+	end = hist_ticks();
+
+	init[run] = (mid - start) / ticks_per_ns / 1e9;
+	first[run] = (end - mid) / ticks_per_ns / 1e9;
+    }
+
+    qsort(init, STARTUP_RUNS, sizeof(double), cmp_double);
+    qsort(first, STARTUP_RUNS, sizeof(double), cmp_double);
+    stats->init_secs = init[STARTUP_RUNS / 2];
+    stats->startup_secs = first[STARTUP_RUNS / 2];
+    stats->startup_ops = requests;
+}
+
+/*
+ * touch_block - Read one byte in each TOUCH_LINE of the first
+ *    TOUCH_BYTES of a block, or write them if write is set, the way
+ *    a program works on the block's contents
+ */
+static void touch_block(volatile char *p, size_t size, int write)
+{
+    size_t off;
+
+    if (size > TOUCH_BYTES)
+	size = TOUCH_BYTES;
+    for (off = 0; off < size; off += TOUCH_LINE) {
+	if (write)
+	    p[off]++;
+	else
+	    (void)p[off];
+    }
+}
+
+/*
+ * eval_mm_touch - Replay a trace the way a program would use it:
+ *    write each payload when it is allocated (and the grown part of a
+ *    realloc'd one), and after each request touch frac of the live
+ *    blocks, picked at random, alternately reading and writing them.
+ *    The tick counter splits the time between the package and the
+ *    touching, so a package that scatters its blocks pays for the
+ *    misses it causes outside malloc. The fastest of TOUCH_RUNS runs
+ *    is stored in stats.
+ */
+static void eval_mm_touch(trace_t *trace, double frac, stats_t *stats)
+{
+    double ticks_per_ns = hist_ticks_per_ns();
+    uint64_t overhead = hist_ticks_overhead();
+    uint64_t start, end, alloc, best = UINT64_MAX;
+    uint64_t rnd;                /* xorshift state, the same each run */
+    size_t *live, *pos;          /* the live ids, and where each one is */
+    size_t num_live, i, j, index, size, oldsize, touched, requests;
+    double quota;                /* blocks owed a touch */
+    int run, type;
+    char *p;
+
+    if ((live = malloc(trace->num_ids * sizeof(size_t))) == NULL ||
+	(pos = malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc failed in eval_mm_touch");
+
+    for (run = 0; run < TOUCH_RUNS; run++) {
+	engine->mem_reset_brk();
+	if (engine->mm_init() < 0)
+	    app_error("mm_init failed in eval_mm_touch");
+	num_live = touched = requests = 0;
+	quota = 0;
+	alloc = 0;
+	rnd = 0x9e3779b97f4a7c15ULL;
+
+	start = hist_ticks();
+	for (i = 0; i < trace->num_ops; i++) {
+	    type = trace->ops[i].type;
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+
+	    switch (type) {
+
+	    case ALLOC: /* mm_malloc */
+		end = hist_ticks();
+		p = engine->mm_malloc(size);
+		alloc += hist_ticks() - end;
+		if (p == NULL)
+		    app_error("mm_malloc error in eval_mm_touch");
+		memset(p, index, size);
+		trace->blocks[index] = p;
+		trace->block_sizes[index] = size;
+		pos[index] = num_live;
+		live[num_live++] = index;
+		break;
+
+	    case REALLOC: /* mm_realloc */
+		oldsize = trace->block_sizes[index];
+		end = hist_ticks();
+		p = engine->mm_realloc(trace->blocks[index], size);
+		alloc += hist_ticks() - end;
+		if (p == NULL)
+		    app_error("mm_realloc error in eval_mm_touch");
+		if (size > oldsize)
+		    memset(p + oldsize, index, size - oldsize);
+		trace->blocks[index] = p;
+		trace->block_sizes[index] = size;
+		break;
+
+	    case FREE: /* mm_free */
+		end = hist_ticks();
+		engine->mm_free(trace->blocks[index]);
+		alloc += hist_ticks() - end;
+		j = live[--num_live];
+		live[pos[index]] = j;
+		pos[j] = pos[index];
+		break;
+
+	    default: /* barriers are not requests */
+		continue;
+	    }
+	    requests++;
+
+	    /* The program's work between this request and the next */
+	    for (quota += frac * num_live; quota >= 1; quota--) {
+		rnd ^= rnd << 13;
+		rnd ^= rnd >> 7;
+		rnd ^= rnd << 17;
+		j = live[rnd % num_live];
+		touch_block(trace->blocks[j], trace->block_sizes[j],
+			    touched++ & 1);
+	    }
+	}
+	end = hist_ticks();
+
+	if (end - start < best) {
+	    best = end - start;
+	    stats->touch_alloc_secs = 
+		(alloc > requests * overhead ? alloc - requests * overhead : 0) /
+		ticks_per_ns / 1e9;
+	    stats->touch_app_secs = (best - alloc) / ticks_per_ns / 1e9;
+	    stats->touch_blocks = touched;
+	}
+    }
+    free(live);
+    free(pos);
+}
+
+/* The per-page and per-line counts behind eval_mm_locality */
+typedef struct {
+    char *lo;             /* the page boundary at or below the heap */
+    size_t num_pages;     /* pages covered by the arrays below */
+    uint32_t *page_live;  /* live blocks on each page ... */
+    uint32_t *line_live;  /* ... and on each line */
+    size_t *page_window;  /* 1 + the last window each page was touched in */
+    size_t pages, lines;  /* pages and lines with live blocks on them */
+    size_t window_pages;  /* pages touched in the current window */
+} layout_t;
+
+/*
+ * layout_grow - Make the arrays in l cover the heap up to hi
+ */
+static void layout_grow(layout_t *l, char *hi)
+{
+    size_t n = (hi - l->lo) / LOCALITY_PAGE + 1;
+    size_t per = LOCALITY_PAGE / LOCALITY_LINE;
+
+    if (n <= l->num_pages)
+	return;
+    if (n < 2 * l->num_pages)
+	n = 2 * l->num_pages;
+    if ((l->page_live = realloc(l->page_live, n * sizeof(uint32_t))) == NULL ||
+	(l->line_live = realloc(l->line_live, 
+				n * per * sizeof(uint32_t))) == NULL ||
+	(l->page_window = realloc(l->page_window, n * sizeof(size_t))) == NULL)
+	unix_error("realloc failed in layout_grow");
+    memset(l->page_live + l->num_pages, 0, 
+	   (n - l->num_pages) * sizeof(uint32_t));
+    memset(l->line_live + l->num_pages * per, 0, 
+	   (n - l->num_pages) * per * sizeof(uint32_t));
+    memset(l->page_window + l->num_pages, 0, 
+	   (n - l->num_pages) * sizeof(size_t));
+    l->num_pages = n;
+}
+
+/*
+ * layout_add - Count the block [p, p+size) as live (delta 1) or no
+ *    longer live (delta -1), and its pages as touched in window
+ */
+static void layout_add(layout_t *l, char *p, size_t size, int delta,
+		       size_t window)
+{
+    size_t first, last, i;
+
+    if (size == 0)
+	size = 1;
+    layout_grow(l, p + size - 1);
+
+    first = (p - l->lo) / LOCALITY_LINE;
+    last = (p + size - 1 - l->lo) / LOCALITY_LINE;
+    for (i = first; i <= last; i++) {
+	if (delta > 0 && l->line_live[i]++ == 0)
+	    l->lines++;
+	else if (delta < 0 && --l->line_live[i] == 0)
+	    l->lines--;
+    }
+
+    first = (p - l->lo) / LOCALITY_PAGE;
+    last = (p + size - 1 - l->lo) / LOCALITY_PAGE;
+    for (i = first; i <= last; i++) {
+	if (delta > 0 && l->page_live[i]++ == 0)
+	    l->pages++;
+	else if (delta < 0 && --l->page_live[i] == 0)
+	    l->pages--;
+	if (l->page_window[i] != window + 1) {
+	    l->page_window[i] = window + 1;
+	    l->window_pages++;
+	}
+    }
+}
+
+/*
+ * eval_mm_locality - Replay a trace once more and measure what util
+ *    doesn't: how far apart consecutive allocations land, how densely
+ *    the live blocks fill the LOCALITY_PAGE pages and LOCALITY_LINE
+ *    lines they span, averaged over the requests, and how many pages
+ *    the requests' blocks touch per LOCALITY_WINDOW requests, the
+ *    working set a TLB has to cover
+ */
+static void eval_mm_locality(trace_t *trace, stats_t *stats)
+{
+    static hist_t dists;
+    layout_t l = {0};
+    double page_sum = 0, line_sum = 0, byte_sum = 0, window_sum = 0;
+    size_t i, index, size, live_bytes = 0, requests = 0;
+    char *p, *prev = NULL;
+
+    hist_reset(&dists);
+
+    engine->mem_reset_brk();
+    if (engine->mm_init() < 0)
+	app_error("mm_init failed in eval_mm_locality");
+    /* Count real pages and lines: a malloc'd heap needn't start on one */
+    l.lo = (char *)((uintptr_t)engine->mem_heap_lo() & 
+		    ~(uintptr_t)(LOCALITY_PAGE - 1));
+
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+
+	switch (trace->ops[i].type) {
+
+	case ALLOC: /* mm_malloc */
+	    if ((p = engine->mm_malloc(size)) == NULL)
+		app_error("mm_malloc error in eval_mm_locality");
+	    break;
+
+	case REALLOC: /* mm_realloc */
+	    p = trace->blocks[index];
+	    layout_add(&l, p, trace->block_sizes[index], -1, 
+		       requests / LOCALITY_WINDOW);
+	    live_bytes -= trace->block_sizes[index];
+	    if ((p = engine->mm_realloc(p, size)) == NULL)
+		app_error("mm_realloc error in eval_mm_locality");
+	    break;
+
+	case FREE: /* mm_free */
+	    p = trace->blocks[index];
+	    engine->mm_free(p);
+	    layout_add(&l, p, trace->block_sizes[index], -1, 
+		       requests / LOCALITY_WINDOW);
+	    live_bytes -= trace->block_sizes[index];
+	    p = NULL;
+	    break;
+
+	default: /* barriers are not requests */
+	    continue;
+	}
+
+	/* A new or moved block */
+	if (p != NULL) {
+	    if (prev != NULL)
+		hist_add(&dists, (p > prev) ? p - prev : prev - p);
+	    prev = p;
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    layout_add(&l, p, size, 1, requests / LOCALITY_WINDOW);
+	    live_bytes += size;
+	}
+
+	page_sum += l.pages;
+	line_sum += l.lines;
+	byte_sum += live_bytes;
+	if (++requests % LOCALITY_WINDOW == 0) {
+	    window_sum += l.window_pages;
+	    l.window_pages = 0;
+	}
+    }
+    /* A trace shorter than one window is one short window */
+    if (requests < LOCALITY_WINDOW)
+	window_sum = l.window_pages;
+
+    stats->dist = hist_percentile(&dists, 50);
+    stats->pages = requests ? page_sum / requests : 0;
+    stats->page_fill = page_sum ? byte_sum / (page_sum * LOCALITY_PAGE) : 0;
+    stats->line_fill = line_sum ? byte_sum / (line_sum * LOCALITY_LINE) : 0;
+    stats->ws_pages = (requests < LOCALITY_WINDOW) ? window_sum :
+	window_sum / (requests / LOCALITY_WINDOW);
+
+    free(l.page_live);
+    free(l.line_live);
+    free(l.page_window);
+}
+
+/*
+ * eval_mm_soak - Replay the valid traces one after another, iters
+ *    times over, on one heap that mm_init sees only once, and print a
+ *    line per iteration: its throughput and how far that has drifted
+ *    from the first iteration's, the heap's size and growth, and the
+ *    peak payload over the heap. The blocks a trace leaves live are
+ *    freed before the next one. A package that fragments its heap a
+ *    little on each pass shows it here long before it runs out.
+ */
+static void eval_mm_soak(char **tracefiles, int n, stats_t *stats, int iters)
+{
+    double ticks_per_ns = hist_ticks_per_ns();
+    trace_t **traces;
+    int *tracenums;
+    int i, iter, ntraces = 0;
+    size_t j, index, size, live, peak;
+    uint64_t start, ticks;
+    double ops, kops, first_kops = 0, heap, last_heap = 0;
+    traceop_t *op;
+    char *p;
+
+    if ((traces = malloc(n * sizeof(trace_t *))) == NULL ||
+	(tracenums = malloc(n * sizeof(int))) == NULL)
+	unix_error("malloc failed in eval_mm_soak");
+    for (i = 0; i < n; i++) {
+	if (stats[i].valid) {
+	    tracenums[ntraces] = i;
+	    traces[ntraces++] = read_trace(tracedir, tracefiles[i]);
+	}
+    }
+    if (ntraces == 0) {
+	printf("No valid traces to soak\n");
+	free(traces);
+	free(tracenums);
+	return;
+    }
+
+    printf("Soaking mm malloc in %d trace%s, %d times over on one heap:\n",
+	   ntraces, (ntraces > 1) ? "s" : "", iters);
+    printf("%5s%10s%8s%9s%9s%9s%6s\n", 
+	   "iter", "Kops", "drift", "brkKB", "+KB", "rssKB", "util");
+
+    engine->mem_reset_brk();
+    if (engine->mm_init() < 0)
+	app_error("mm_init failed in eval_mm_soak");
+
+    for (iter = 1; iter <= iters; iter++) {
+	ops = 0;
+	ticks = 0;
+	live = peak = 0;
+	for (i = 0; i < ntraces; i++) {
+	    memset(traces[i]->blocks, 0, traces[i]->num_ids * sizeof(char *));
+	    start = hist_ticks();
+	    for (j = 0; j < traces[i]->num_ops; j++) {
+		op = &traces[i]->ops[j];
+		index = op->index;
+		size = op->size;
+
+		switch (op->type) {
+
+		case ALLOC: /* mm_malloc */
+		    if ((p = engine->mm_malloc(size)) == NULL)
+			goto failed;
+		    traces[i]->blocks[index] = p;
+		    traces[i]->block_sizes[index] = size;
+		    live += size;
+		    break;
+
+		case REALLOC: /* mm_realloc */
+		    p = engine->mm_realloc(traces[i]->blocks[index], size);
+		    if (p == NULL)
+			goto failed;
+		    live += size - traces[i]->block_sizes[index];
+		    traces[i]->blocks[index] = p;
+		    traces[i]->block_sizes[index] = size;
+		    break;
+
+		case FREE: /* mm_free */
+		    engine->mm_free(traces[i]->blocks[index]);
+		    traces[i]->blocks[index] = NULL;
+		    live -= traces[i]->block_sizes[index];
+		    break;
+
+		default: /* barriers are not requests */
+		    continue;
+		}
+		if (live > peak)
+		    peak = live;
+		ops++;
+	    }
+	    ticks += hist_ticks() - start;
+
+	    /* Whatever the trace left live, so the next one starts even */
+	    for (index = 0; index < traces[i]->num_ids; index++) {
+		if (traces[i]->blocks[index] != NULL) {
+		    engine->mm_free(traces[i]->blocks[index]);
+		    live -= traces[i]->block_sizes[index];
+		}
+	    }
+	}
+
+	kops = (ticks > 0) ? ops / (ticks / ticks_per_ns / 1e9) / 1e3 : 0;
+	if (iter == 1)
+	    first_kops = kops;
+	heap = engine->mem_heapsize();
+	printf("%5d%10.0f%+7.1f%%%9.0f%+9.0f%9.0f%5.0f%%\n", iter, kops,
+	       (first_kops > 0) ? 100.0 * (kops - first_kops) / first_kops : 0,
+	       heap/1024, (heap - last_heap)/1024,
+	       engine->mem_resident_pages() * mem_pagesize() / 1024.0,
+	       (heap > 0) ? 100.0 * peak / heap : 0);
+	fflush(stdout);
+	last_heap = heap;
+    }
+    goto done;
+
+ failed:
+    /* A binary trace has no lines, so count its requests from 1 */
+    sprintf(msg, "%s%s", tracedir, tracefiles[tracenums[i]]);
+    if (tracefile_is_binary(msg))
+	printf("%5d  ran out of heap at %.0f KB in trace %d, request %llu\n",
+	       iter, engine->mem_heapsize() / 1024.0, tracenums[i], 
+	       (unsigned long long)j + 1);
+    else
+	printf("%5d  ran out of heap at %.0f KB in trace %d, line %lu\n", 
+	       iter, engine->mem_heapsize() / 1024.0, tracenums[i], 
+	       (unsigned long)LINENUM(j));
+
+ done:
+    for (i = 0; i < ntraces; i++)
+	free_trace(traces[i]);
+    free(traces);
+    free(tracenums);
+}
+
+/*
+ * eval_libc_valid - We run this function to make sure that the
+ *    libc malloc (or the sysalloc in its place) can run to completion
+ *    on the set of traces. We'll be conservative and terminate if any
+ *    of its calls fails.
+ */
+static int eval_libc_valid(trace_t *trace, int tracenum)
+{
+    size_t i, newsize;
+    char *p, *newp, *oldp;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* malloc */
+	    if ((p = sysalloc->malloc(trace->ops[i].size)) == NULL) {
+		sprintf(msg, "%s malloc failed", sysalloc->name);
+		malloc_error(tracenum, i, msg);
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+	case REALLOC: /* realloc */
+            newsize = trace->ops[i].size;
+	    oldp = trace->blocks[trace->ops[i].index];
+	    if ((newp = sysalloc->realloc(oldp, newsize)) == NULL) {
+		sprintf(msg, "%s realloc failed", sysalloc->name);
+		malloc_error(tracenum, i, msg);
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = newp;
+	    break;
+	    
+        case FREE: /* free */
+	    sysalloc->free(trace->blocks[trace->ops[i].index]);
+	    break;
+
+	case BARRIER: /* only matters when replaying threads */
+	    break;
+
+	default:
+	    app_error("invalid operation type  in eval_libc_valid");
+	}
+    }
+
+    return 1;
+}
+
+/* 
+ * eval_libc_speed - This is the function that is used by fcyc() to
+ *    measure the running time of the libc malloc package on the set
+ *    of traces.
+ */
+static void eval_libc_speed(void *ptr)
+{
+    size_t i;
+    size_t index, size, newsize;
+    char *p, *newp, *oldp, *block;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        switch (trace->ops[i].type) {
+        case ALLOC: /* malloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if ((p = sysalloc->malloc(size)) == NULL)
+		unix_error("malloc failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
+
+	case REALLOC: /* realloc */
+	    index = trace->ops[i].index;
+	    newsize = trace->ops[i].size;
+	    oldp = trace->blocks[index];
+	    if ((newp = sysalloc->realloc(oldp, newsize)) == NULL)
+		unix_error("realloc failed in eval_libc_speed\n");
+	    
+	    trace->blocks[index] = newp;
+	    break;
+	    
+        case FREE: /* free */
+	    index = trace->ops[i].index;
+	    block = trace->blocks[index];
+	    sysalloc->free(block);
+	    break;
+
+	case BARRIER: /* only matters when replaying threads */
+	    break;
+	}
+    }
+}
+
+/*
+ * eval_sysalloc - check and time the malloc in a on each trace, with
+ *    eval_libc_valid and eval_libc_speed
+ */
+static void eval_sysalloc(sysalloc_t *a, char **tracefiles, int n,
+			  stats_t *stats)
+{
+    trace_t *trace;
+    speed_t speed_params;
+    int i;
+
+    sysalloc = a;
+    for (i = 0; i < n; i++) {
+	trace = read_trace(tracedir, tracefiles[i]);
+	stats[i].ops = trace->num_ops;
+	if (verbose > 1)
+	    printf("Checking %s malloc for correctness, ", a->name);
+	stats[i].valid = eval_libc_valid(trace, i);
+	if (stats[i].valid) {
+	    speed_params.trace = trace;
+	    if (verbose > 1)
+		printf("and performance.\n");
+	    stats[i].secs = fsecs_less(eval_libc_speed, eval_null_speed,
+				       &speed_params, &stats[i].ci);
+	}
+	free_trace(trace);
+    }
+}
+
+/*
+ * eval_libc_stream_speed - The streaming counterpart of
+ *    eval_libc_speed, which keeps the live blocks in an id map as
+ *    eval_mm_stream_speed does. Blocks the trace leaves live are
+ *    freed at the end, so that runs don't pile up in the malloc heap.
+ */
+static void eval_libc_stream_speed(void *ptr)
+{
+    speed_t *params = (speed_t *)ptr;
+    tracestream_t ts;
+    traceop_t *window;
+    idmap_t map;
+    idslot_t *slot;
+    int i, n;
+    size_t j;
+    char *p;
+
+    if (tracestream_open(params->path, STREAM_WINDOW, &ts) < 0)
+	app_error("tracestream_open failed in eval_libc_stream_speed");
+    idmap_init(&map);
+
+    params->ops = 0;
+    while ((n = tracestream_next(&ts, &window)) > 0) {
+	params->ops += n;
+	for (i = 0; i < n; i++)
+	    switch (window[i].type) {
+
+	    case ALLOC: /* malloc */
+		if ((p = sysalloc->malloc(window[i].size)) == NULL)
+		    unix_error("malloc failed in eval_libc_stream_speed");
+		idmap_insert(&map, window[i].index, p, window[i].size);
+		break;
+
+	    case REALLOC: /* realloc */
+		if ((slot = idmap_find(&map, window[i].index)) == NULL)
+		    app_error("realloc of a block that isn't live in "
+			      "eval_libc_stream_speed");
+		if ((p = sysalloc->realloc(slot->p, window[i].size)) == NULL)
+		    unix_error("realloc failed in eval_libc_stream_speed");
+		slot->p = p;
+		break;
+
+	    case FREE: /* free */
+		if ((slot = idmap_find(&map, window[i].index)) == NULL)
+		    app_error("free of a block that isn't live in "
+			      "eval_libc_stream_speed");
+		sysalloc->free(slot->p);
+		idmap_delete(&map, slot);
+		break;
+
+	    case BARRIER: /* only matters when replaying threads */
+		break;
+	    }
+    }
+    if (n < 0)
+	stream_error(&ts, params->path);
+
+    for (j = 0; j <= map.mask; j++)
+	if (map.slots[j].index != NO_ID)
+	    sysalloc->free(map.slots[j].p);
+    idmap_free(&map);
+    tracestream_close(&ts);
+}
+
+/*
+ * eval_sysalloc_stream - time the malloc in a on each trace, streamed
+ *    as with -s. Nothing is checked beyond what keeps the replay
+ *    sound: a failed request, or one on a block that isn't live,
+ *    is fatal.
+ */
+static void eval_sysalloc_stream(sysalloc_t *a, char **tracefiles, int n,
+				 stats_t *stats)
+{
+    speed_t speed_params;
+    char path[MAXLINE];
+    int i;
+
+    sysalloc = a;
+    for (i = 0; i < n; i++) {
+	strcpy(path, tracedir);
+	strcat(path, tracefiles[i]);
+	if (verbose > 1)
+	    printf("Streaming %s through %s malloc.\n", tracefiles[i],
+		   a->name);
+	speed_params.path = path;
+	stats[i].secs = fsecs_less(eval_libc_stream_speed,
+				   eval_null_stream_speed, &speed_params,
+				   &stats[i].ci);
+	stats[i].ops = speed_params.ops;
+	stats[i].valid = 1;
+    }
+}
+
+/*
+ * eval_null_speed - This is the function that is used by fcyc() to
+ *    measure what the xxx_speed loops themselves cost: it walks the
+ *    trace and updates the block array the same way, but makes no
+ *    allocator calls.
+ */
+static void eval_null_speed(void *ptr)
+{
+    static char dummy;
+    size_t i;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+
+    engine->mem_reset_brk();
+    for (i = 0;  i < trace->num_ops;  i++) {
+        switch (trace->ops[i].type) {
+        case ALLOC: /* malloc */
+	case REALLOC: /* realloc */
+	    trace->blocks[trace->ops[i].index] = &dummy;
+	    break;
+        case FREE: /* free */
+	    dummy = *trace->blocks[trace->ops[i].index];
+	    break;
+	case BARRIER: /* only matters when replaying threads */
+	    break;
+	}
+    }
+}
+
+/*
+ * replay_overhead - Return the time the speed loops spend on a trace
+ *    outside the allocator, which is taken off their measured times
+ */
+static double replay_overhead(trace_t *trace)
+{
+    speed_t speed_params;
+
+    speed_params.trace = trace;
+    return fsecs(eval_null_speed, &speed_params);
+}
+
+/*****************************************************************
+ * The following routines compare a candidate package against a
+ * baseline (--baseline), trace by trace. Utilization is exact, so
+ * it is compared directly. Throughput is noisy, so the two packages
+ * are timed in ABBA rounds, where any drift in the machine's speed
+ * over a round affects both alike, and the candidate's relative
+ * throughput is estimated from the ratio of each round's times
+ * until its 95% confidence interval is tight enough.
+ ****************************************************************/
+
+/*
+ * eval_ab_trace - compare the two packages in eng[] on one trace
+ */
+static void eval_ab_trace(engine_t *eng[2], char *filename, int tracenum,
+			  range_t **ranges, abstats_t *ab)
+{
+    trace_t *trace;
+    speed_t speed_params;
+    struct timespec first, now;
+    double overhead, t[2], x, delta, mean = 0, m2 = 0;
+    int e, n;
+
+    memset(ab, 0, sizeof(*ab));
+    trace = read_trace(tracedir, filename);
+    ab->ops = trace->num_ops;
+    for (e = 0; e < 2; e++) {
+	engine = eng[e];
+	if (verbose > 1)
+	    printf("Checking %s for correctness and efficiency.\n", 
+		   engine->name);
+	if ((ab->valid[e] = eval_mm_valid(trace, tracenum, ranges)))
+	    ab->util[e] = eval_mm_util(trace, tracenum, ranges, NULL);
+    }
+
+    if (ab->valid[0] && ab->valid[1]) {
+	if (verbose > 1)
+	    printf("Comparing performance.\n");
+	speed_params.trace = trace;
+	speed_params.ranges = *ranges;
+	overhead = replay_overhead(trace);
+	for (n = 0; n < FTIMER_WARMUP; n++) {
+	    for (e = 0; e < 2; e++) {
+		engine = eng[e];
+		eval_mm_speed(&speed_params);
+	    }
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &first);
+	for (n = 1; n <= FTIMER_MAX_RUNS; n++) {
+	    engine = eng[0];
+	    t[0] = ftimer_once(eval_mm_speed, &speed_params);
+	    engine = eng[1];
+	    t[1] = ftimer_once(eval_mm_speed, &speed_params);
+	    t[1] += ftimer_once(eval_mm_speed, &speed_params);
+	    engine = eng[0];
+	    t[0] += ftimer_once(eval_mm_speed, &speed_params);
+
+	    for (e = 0; e < 2; e++) {
+		t[e] = t[e]/2 - overhead;
+		ab->secs[e] += (t[e] - ab->secs[e]) / n;
+	    }
+
+	    /* Welford's running mean and sum of squared deviations */
+	    x = t[0]/t[1] - 1;
+	    delta = x - mean;
+	    mean += delta / n;
+	    m2 += delta * (x - mean);
+	    ab->runs = n;
+
+	    if (n >= FTIMER_MIN_RUNS) {
+		ab->ci = ftimer_tcrit(n - 1) * sqrt(m2 / (n - 1) / n);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (ab->ci <= FTIMER_CI_TARGET ||
+		    (now.tv_sec - first.tv_sec) + 
+		    1E-9*(now.tv_nsec - first.tv_nsec) >= FTIMER_MAX_SECS)
+		    break;
+	    }
+	}
+	ab->dthru = mean;
+    }
+    engine = eng[0];
+
+    ab->regressed = (ab->valid[0] && !ab->valid[1]) ||
+	(ab->valid[0] && ab->util[1] < ab->util[0] - AB_UTIL_TOL) ||
+	(ab->runs > 0 && ab->dthru + ab->ci < -AB_THRU_TOL);
+    free_trace(trace);
+}
+
+/*
+ * eval_ab - compare the candidate eng[1] against the baseline eng[0]
+ *    on each trace, print the deltas and a verdict, and return the
+ *    number of traces on which the candidate regressed
+ */
+static int eval_ab(engine_t *eng[2], char **tracefiles, int n)
+{
+    abstats_t *ab;
+    range_t *ranges = NULL;
+    double util[2] = {0, 0}, secs[2] = {0, 0}, ops = 0;
+    int i, regressions = 0, compared = 0;
+
+    if ((ab = calloc(n, sizeof(abstats_t))) == NULL)
+	unix_error("ab calloc in eval_ab failed");
+    for (i = 0; i < n; i++) {
+	if (verbose > 1)
+	    printf("\nReading tracefile: %s\n", tracefiles[i]);
+	eval_ab_trace(eng, tracefiles[i], i, &ranges, &ab[i]);
+    }
+
+    printf("\nCandidate %s (%s) against baseline %s (%s):\n",
+	   eng[1]->name, eng[1]->team->teamname, 
+	   eng[0]->name, eng[0]->team->teamname);
+    printf("%5s%7s%8s%8s%8s%10s%10s%9s%8s%6s  %s\n", "trace", "valid",
+	   "util A", "util B", "delta", "Kops A", "Kops B", "delta", "+/-",
+	   "runs", "verdict");
+    for (i = 0; i < n; i++) {
+	printf("%2d%10s", i, ab[i].valid[0] ? 
+	       (ab[i].valid[1] ? "yes/yes" : "yes/no") :
+	       (ab[i].valid[1] ? "no/yes" : "no/no"));
+	if (ab[i].valid[0])
+	    printf("%7.1f%%", ab[i].util[0]*100.0);
+	else
+	    printf("%8s", "-");
+	if (ab[i].valid[1])
+	    printf("%7.1f%%", ab[i].util[1]*100.0);
+	else
+	    printf("%8s", "-");
+	if (ab[i].valid[0] && ab[i].valid[1])
+	    printf("%+8.1f", (ab[i].util[1] - ab[i].util[0])*100.0);
+	else
+	    printf("%8s", "-");
+	if (ab[i].runs > 0) {
+	    printf("%10.0f%10.0f%+8.1f%%%7.1f%%%6d",
+		   (ab[i].ops/1e3)/ab[i].secs[0], (ab[i].ops/1e3)/ab[i].secs[1],
+		   ab[i].dthru*100.0, ab[i].ci*100.0, ab[i].runs);
+	    util[0] += ab[i].util[0];
+	    util[1] += ab[i].util[1];
+	    secs[0] += ab[i].secs[0];
+	    secs[1] += ab[i].secs[1];
+	    ops += ab[i].ops;
+	    compared++;
+	}
+	else
+	    printf("%10s%10s%9s%8s%6s", "-", "-", "-", "-", "-");
+	printf("  %s\n", ab[i].regressed ? "REGRESSED" : "ok");
+	regressions += ab[i].regressed;
+    }
+
+    /* Totals over the traces that both packages passed */
+    if (compared > 0) {
+	printf("%-12s%7.1f%%%7.1f%%%+8.1f%10.0f%10.0f%+8.1f%%\n", "Total",
+	       util[0]/compared*100.0, util[1]/compared*100.0,
+	       (util[1] - util[0])/compared*100.0,
+	       (ops/1e3)/secs[0], (ops/1e3)/secs[1], 
+	       (secs[0]/secs[1] - 1)*100.0);
+    }
+
+    if (regressions)
+	printf("\nVerdict: FAIL (regressed on %d of %d traces)\n", 
+	       regressions, n);
+    else
+	printf("\nVerdict: PASS\n");
+    free(ab);
+    return regressions;
+}
+
+/*************************************
+ * Some miscellaneous helper routines
+ ************************************/
+
+
+/*
+ * printresults - prints a performance summary for some malloc package,
+ *    with the layout of its blocks next to util if measured (--locality)
+ */
+static void printresults(int n, stats_t *stats, evalopts_t *opts) 
+{
+    int i;
+    int locality = opts && opts->locality;
+    double secs = 0;
+    double ci2 = 0;
+    double ops = 0;
+    double util = 0;
+    double page_fill = 0;
+    double line_fill = 0;
+
+    /* Print the individual results for each trace */
+    printf("%5s%7s %5s", "trace", " valid", "util");
+    if (locality)
+	printf("%9s%8s%6s%6s%7s", "dist", "pages", "pg%", "ln%", "ws/1k");
+    printf("%8s%10s%7s%6s%9s%9s\n", 
+	   "ops", "secs", "+/-", "Kops", "brkKB", "rssKB");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%10s%5.0f%%", i, "yes", stats[i].util*100.0);
+	    if (locality)
+		printf("%9.0f%8.0f%5.0f%%%5.0f%%%7.0f", stats[i].dist, 
+		       stats[i].pages, stats[i].page_fill*100.0, 
+		       stats[i].line_fill*100.0, stats[i].ws_pages);
+	    printf("%8.0f%10.6f%6.1f%%%6.0f", 
+		   stats[i].ops,
+		   stats[i].secs,
+		   100.0*stats[i].ci/stats[i].secs,
+		   (stats[i].ops/1e3)/stats[i].secs);
+	    if (stats[i].heap > 0)
+		printf("%9.0f%9.0f\n", stats[i].heap/1024, stats[i].resident/1024);
+	    else
+		printf("%9s%9s\n", "-", "-");
+	    secs += stats[i].secs;
+	    ci2 += stats[i].ci * stats[i].ci;
+	    ops += stats[i].ops;
+	    util += stats[i].util;
+	    page_fill += stats[i].page_fill;
+	    line_fill += stats[i].line_fill;
+	}
+	else {
+	    printf("%2d%10s%6s", i, "no", "-");
+	    if (locality)
+		printf("%9s%8s%6s%6s%7s", "-", "-", "-", "-", "-");
+	    printf("%8s%10s%7s%6s%9s%9s\n", 
+		   "-",
+		   "-",
+		   "-",
+		   "-",
+		   "-",
+		   "-");
+	}
+    }
+
+    /* Print the aggregate results for the set of traces */
+    if (errors == 0) {
+	/* The traces are timed independently, so their variances add */
+	printf("%12s%5.0f%%", "Total       ", (util/n)*100.0);
+	if (locality)
+	    printf("%9s%8s%5.0f%%%5.0f%%%7s", "", "", (page_fill/n)*100.0,
+		   (line_fill/n)*100.0, "");
+	printf("%8.0f%10.6f%6.1f%%%6.0f\n", 
+	       ops, 
+	       secs,
+	       100.0*sqrt(ci2)/secs,
+	       (ops/1e3)/secs);
+    }
+    else {
+	printf("%12s%6s", "Total       ", "-");
+	if (locality)
+	    printf("%9s%8s%6s%6s%7s", "", "", "-", "-", "");
+	printf("%8s%10s%7s%6s\n", 
+	       "-", 
+	       "-", 
+	       "-", 
+	       "-");
+    }
+
+}
+
+/*
+ * printsuite - prints mm's utilization on each trace of a suite next
+ *    to the trace's reference (see read_util_ref), and its throughput
+ *    next to libc's on the same trace
+ */
+static void printsuite(int n, char **tracefiles, stats_t *stats,
+		       double *util_ref, stats_t *libc_stats)
+{
+    int i;
+    double kops, libc_kops;
+
+    printf("%-26s%6s%8s%8s%10s%10s%8s\n", "trace", "util", "ref", "diff",
+	   "Kops", "libc", "ratio");
+    for (i=0; i < n; i++) {
+	libc_kops = (libc_stats[i].ops/1e3)/libc_stats[i].secs;
+	if (!stats[i].valid) {
+	    printf("%-26s%6s%7.0f%%%8s%10s%10.0f%8s\n", tracefiles[i], "-",
+		   util_ref[i]*100.0, "-", "-", libc_kops, "-");
+	    continue;
+	}
+	kops = (stats[i].ops/1e3)/stats[i].secs;
+	printf("%-26s%5.0f%%%7.0f%%%+7.1f%%%10.0f%10.0f%8.2f\n", 
+	       tracefiles[i], stats[i].util*100.0, util_ref[i]*100.0,
+	       (stats[i].util - util_ref[i])*100.0,
+	       kops, libc_kops, kops/libc_kops);
+    }
+}
+
+/*
+ * read_util_ref - read the utilization reference that gentrace -u
+ *    wrote next to the trace at path: what an allocator with boundary
+ *    tags and no fragmentation would reach on it
+ */
+static double read_util_ref(char *path)
+{
+    char refpath[MAXLINE];
+    FILE *fp;
+    double util = 0;
+
+    sprintf(refpath, "%.*s.util", MAXLINE - 6, path);
+    if ((fp = fopen(refpath, "r")) == NULL || fscanf(fp, "%lf", &util) != 1 ||
+	!(util > 0 && util <= 1)) {
+	printf("ERROR: %s is missing or bogus; remove %s and \"make"
+	       " large-traces\" writes both again\n", refpath, path);
+	exit(1);
+    }
+    fclose(fp);
+    return util;
+}
+
+/*
+ * printcompare - prints the throughput of mm malloc and of each
+ *    allocator in sys on each trace, then for all of them together,
+ *    and how mm malloc's compares with each
+ */
+static void printcompare(int n, stats_t *mm_stats, int nsys,
+			 sysalloc_t *sys, stats_t **sys_stats)
+{
+    int i, k;
+    double secs, ops, mm_kops, kops[MAX_ALLOCATORS];
+
+    for (k = 0; k < nsys; k++)
+	printf("  [%d] %s\n", k + 1, sys[k].name);
+    printf("%5s%10s", "trace", "mm");
+    for (k = 0; k < nsys; k++) {
+	sprintf(msg, "[%d]", k + 1);
+	printf("%10s", msg);
+    }
+    printf("\n");
+
+    for (i = 0; i < n; i++) {
+	printf("%2d   ", i);
+	if (mm_stats[i].valid)
+	    printf("%10.0f", (mm_stats[i].ops/1e3)/mm_stats[i].secs);
+	else
+	    printf("%10s", "-");
+	for (k = 0; k < nsys; k++)
+	    if (sys_stats[k][i].valid)
+		printf("%10.0f", (sys_stats[k][i].ops/1e3)/sys_stats[k][i].secs);
+	    else
+		printf("%10s", "-");
+	printf("\n");
+    }
+
+    /* Totals weigh each trace by its time, as printresults does */
+    secs = ops = 0;
+    for (i = 0; i < n; i++) {
+	secs += mm_stats[i].secs;
+	ops += mm_stats[i].ops;
+    }
+    mm_kops = (ops/1e3)/secs;
+    if (errors == 0)
+	printf("%-5s%10.0f", "Total", mm_kops);
+    else
+	printf("%-5s%10s", "Total", "-");
+    for (k = 0; k < nsys; k++) {
+	secs = ops = 0;
+	for (i = 0; i < n; i++) {
+	    secs += sys_stats[k][i].secs;
+	    ops += sys_stats[k][i].ops;
+	}
+	kops[k] = (ops/1e3)/secs;
+	printf("%10.0f", kops[k]);
+    }
+    printf("\n");
+    if (errors > 0)
+	return;
+    printf("%-15s", "mm / [k]");
+    for (k = 0; k < nsys; k++)
+	printf("%9.2fx", mm_kops/kops[k]);
+    printf("\n");
+}
+
+/*
+ * printlatency - prints the latency percentiles of each type of
+ *    request, next to the throughput, for each valid trace
+ */
+static void printlatency(int n, stats_t *stats)
+{
+    static char *names[3] = {"malloc", "free", "realloc"};
+    lat_t *lat;
+    int i, type, first;
+
+    printf("%5s%7s%9s%8s%8s%8s%8s%8s%10s\n",
+	   "trace", "Kops", "op", "count", "p50", "p90", "p99", "p99.9", "max");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%10s\n", i, "-");
+	    continue;
+	}
+	first = 1;
+	for (type = 0; type < 3; type++) {
+	    lat = &stats[i].lat[type];
+	    if (lat->count == 0)
+		continue;
+	    if (first)
+		printf("%2d%10.0f", i, (stats[i].ops/1e3)/stats[i].secs);
+	    else
+		printf("%12s", "");
+	    printf("%9s%8.0f%8.0f%8.0f%8.0f%8.0f%10.0f\n", names[type],
+		   lat->count, lat->p50, lat->p90, lat->p99, lat->p999, lat->max);
+	    first = 0;
+	}
+    }
+}
+
+/*
+ * printcounters - prints the hardware events per request for each
+ *    valid trace, and the instructions per cycle if both are known
+ */
+static void printcounters(int n, stats_t *stats)
+{
+    int i, j;
+    double *ctr;
+
+    printf("%5s", "trace");
+    for (j = 0; j < PERFCTR_NUM; j++)
+	printf("%10s", perfctr_names[j]);
+    printf("%6s\n", "IPC");
+
+    for (i = 0; i < n; i++) {
+	printf("%2d   ", i);
+	ctr = stats[i].ctr;
+	for (j = 0; j < PERFCTR_NUM; j++) {
+	    if (stats[i].valid && ctr[j] >= 0)
+		printf("%10.2f", ctr[j]);
+	    else
+		printf("%10s", "-");
+	}
+	if (stats[i].valid && ctr[PERFCTR_CYCLES] > 0 && 
+	    ctr[PERFCTR_INSTRUCTIONS] >= 0)
+	    printf("%6.2f\n", ctr[PERFCTR_INSTRUCTIONS] / ctr[PERFCTR_CYCLES]);
+	else
+	    printf("%6s\n", "-");
+    }
+}
+
+/*
+ * printstartup - prints the cold time of mm_init and of the first
+ *    requests after it for each valid trace, next to the time per
+ *    request in the warm, steady-state runs
+ */
+static void printstartup(int n, stats_t *stats)
+{
+    int i;
+    double cold, warm;
+
+    printf("%5s%10s%9s%10s%10s%10s%8s\n", 
+	   "trace", "init us", "ops", "first us", "ns/op", "warm", "x");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d   %10s%9s%10s%10s%10s%8s\n", i, "-", "-", "-", "-", "-",
+		   "-");
+	    continue;
+	}
+	cold = (stats[i].startup_ops > 0) ? 
+	    stats[i].startup_secs / stats[i].startup_ops * 1e9 : 0;
+	warm = (stats[i].ops > 0) ? stats[i].secs / stats[i].ops * 1e9 : 0;
+	printf("%2d   %10.2f%9.0f%10.2f%10.1f%10.1f",
+	       i, stats[i].init_secs * 1e6, stats[i].startup_ops,
+	       stats[i].startup_secs * 1e6, cold, warm);
+	if (warm > 0)
+	    printf("%8.1f\n", cold / warm);
+	else
+	    printf("%8s\n", "-");
+    }
+}
+
+/*
+ * printtouch - prints the time per request spent in the package and in
+ *    touching the payloads for each valid trace, and how the former
+ *    compares with the package's time when nothing is touched
+ */
+static void printtouch(int n, stats_t *stats)
+{
+    int i;
+    double ops, alloc, warm;
+
+    printf("%5s%10s%10s%10s%10s%10s%8s\n", 
+	   "trace", "blocks/op", "malloc", "app", "total", "untouched", "x");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid || stats[i].ops == 0) {
+	    printf("%2d   %10s%10s%10s%10s%10s%8s\n", i, "-", "-", "-", "-", "-",
+		   "-");
+	    continue;
+	}
+	ops = stats[i].ops;
+	alloc = stats[i].touch_alloc_secs / ops * 1e9;
+	warm = stats[i].secs / ops * 1e9;
+	printf("%2d   %10.1f%10.1f%10.1f%10.1f%10.1f",
+	       i, stats[i].touch_blocks / ops, alloc, 
+	       stats[i].touch_app_secs / ops * 1e9,
+	       alloc + stats[i].touch_app_secs / ops * 1e9, warm);
+	if (warm > 0)
+	    printf("%8.2f\n", alloc / warm);
+	else
+	    printf("%8s\n", "-");
+    }
+}
+
+/*
+ * The following routines write the results in machine-readable form
+ * (--json and --csv), along with what is needed to compare one run
+ * with another: the engine, how it was built, how it was timed, and
+ * the host it ran on.
+ */
+
+/*
+ * get_runinfo - fill in the run-wide facts
+ */
+static void get_runinfo(runinfo_t *info)
+{
+    time_t now = time(NULL);
+
+    strftime(info->time, sizeof(info->time), "%Y-%m-%dT%H:%M:%SZ", 
+	     gmtime(&now));
+    if (uname(&info->host) < 0)
+	memset(&info->host, 0, sizeof(info->host));
+    info->cpus = sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+/*
+ * json_string - write str as a JSON string
+ */
+static void json_string(FILE *fp, char *str)
+{
+    fputc('"', fp);
+    for (; *str; str++) {
+	if (*str == '"' || *str == '\\')
+	    fprintf(fp, "\\%c", *str);
+	else if ((unsigned char)*str < 0x20)
+	    fprintf(fp, "\\u%04x", *str);
+	else
+	    fputc(*str, fp);
+    }
+    fputc('"', fp);
+}
+
+/*
+ * json_number - write x, or null if it is not a finite number
+ */
+static void json_number(FILE *fp, double x)
+{
+    if (isfinite(x))
+	fprintf(fp, "%.9g", x);
+    else
+	fprintf(fp, "null");
+}
+
+/*
+ * json_stats - write the results of one package on each trace
+ */
+static void json_stats(FILE *fp, char **tracefiles, int n, stats_t *stats,
+		       evalopts_t *opts)
+{
+    static char *opnames[3] = {"malloc", "free", "realloc"};
+    int i, j;
+    lat_t *lat;
+
+    fprintf(fp, "[");
+    for (i = 0; i < n; i++) {
+	fprintf(fp, "%s\n    {\"trace\": %d, \"file\": ", i ? "," : "", i);
+	json_string(fp, tracefiles[i]);
+	fprintf(fp, ", \"valid\": %s", stats[i].valid ? "true" : "false");
+	if (!stats[i].valid) {
+	    fprintf(fp, "}");
+	    continue;
+	}
+	fprintf(fp, ", \"util\": ");
+	json_number(fp, stats[i].util);
+	fprintf(fp, ", \"ops\": %.0f, \"secs\": ", stats[i].ops);
+	json_number(fp, stats[i].secs);
+	fprintf(fp, ", \"ci_secs\": ");
+	json_number(fp, stats[i].ci);
+	fprintf(fp, ", \"kops\": ");
+	json_number(fp, (stats[i].ops/1e3)/stats[i].secs);
+	fprintf(fp, ", \"heap_bytes\": %.0f, \"resident_bytes\": %.0f",
+		stats[i].heap, stats[i].resident);
+	if (opts && opts->latency) {
+	    fprintf(fp, ",\n     \"latency_ns\": {");
+	    for (j = 0; j < 3; j++) {
+		lat = &stats[i].lat[j];
+		fprintf(fp, "%s\"%s\": {\"count\": %.0f, \"p50\": %.0f, "
+			"\"p90\": %.0f, \"p99\": %.0f, \"p99.9\": %.0f, "
+			"\"max\": %.0f}", j ? ", " : "", opnames[j], lat->count,
+			lat->p50, lat->p90, lat->p99, lat->p999, lat->max);
+	    }
+	    fprintf(fp, "}");
+	}
+	if (opts && opts->counters) {
+	    fprintf(fp, ",\n     \"events_per_op\": {");
+	    for (j = 0; j < PERFCTR_NUM; j++) {
+		fprintf(fp, "%s\"%s\": ", j ? ", " : "", perfctr_names[j]);
+		if (stats[i].ctr[j] >= 0)
+		    json_number(fp, stats[i].ctr[j]);
+		else
+		    fprintf(fp, "null");
+	    }
+	    fprintf(fp, "}");
+	}
+	if (opts && opts->startup) {
+	    fprintf(fp, ",\n     \"startup\": {\"init_ns\": %.0f, \"ops\": %.0f, "
+		    "\"ns\": %.0f}", stats[i].init_secs * 1e9, 
+		    stats[i].startup_ops, stats[i].startup_secs * 1e9);
+	}
+	if (opts && opts->touch) {
+	    fprintf(fp, ",\n     \"touch\": {\"blocks\": %.0f, \"malloc_secs\": ",
+		    stats[i].touch_blocks);
+	    json_number(fp, stats[i].touch_alloc_secs);
+	    fprintf(fp, ", \"app_secs\": ");
+	    json_number(fp, stats[i].touch_app_secs);
+	    fprintf(fp, "}");
+	}
+	if (opts && opts->locality) {
+	    fprintf(fp, ",\n     \"locality\": {\"dist_bytes\": %.0f, "
+		    "\"pages\": ", stats[i].dist);
+	    json_number(fp, stats[i].pages);
+	    fprintf(fp, ", \"page_fill\": ");
+	    json_number(fp, stats[i].page_fill);
+	    fprintf(fp, ", \"line_fill\": ");
+	    json_number(fp, stats[i].line_fill);
+	    fprintf(fp, ", \"ws_pages\": ");
+	    json_number(fp, stats[i].ws_pages);
+	    fprintf(fp, "}");
+	}
+	fprintf(fp, "}");
+    }
+    fprintf(fp, "\n  ]");
+}
+
+/*
+ * write_json - write the whole run as one JSON object
+ */
+static void write_json(FILE *fp, char **tracefiles, int n, stats_t *mm_stats,
+		       int nsys, sysalloc_t *sys, stats_t **sys_stats,
+		       double libc_thruput, evalopts_t *opts, int numcorrect,
+		       double avg_util, double throughput, double perfindex)
+{
+    runinfo_t info;
+    int k;
+
+    get_runinfo(&info);
+    fprintf(fp, "{\n  \"time\": \"%s\",\n", info.time);
+
+    fprintf(fp, "  \"engine\": {\"name\": \"mm\", \"team\": ");
+    json_string(fp, team.teamname);
+    fprintf(fp, ", \"thread_safe\": %s},\n", mm_thread_safe ? "true" : "false");
+
+    fprintf(fp, "  \"build\": {\"compiler\": ");
+    json_string(fp, __VERSION__);
+    fprintf(fp, ", \"bits\": %d, \"optimized\": %s, \"date\": ", 
+	    (int)sizeof(void *) * 8,
+#ifdef __OPTIMIZE__
+	    "true"
+#else
+	    "false"
+#endif
+	    );
+    json_string(fp, __DATE__ " " __TIME__);
+    fprintf(fp, "},\n");
+
+    fprintf(fp, "  \"timing\": {\"method\": ");
+    json_string(fp, fsecs_method());
+    fprintf(fp, ", \"overhead_subtracted\": true},\n");
+
+    fprintf(fp, "  \"host\": {\"name\": ");
+    json_string(fp, info.host.nodename);
+    fprintf(fp, ", \"os\": ");
+    json_string(fp, info.host.sysname);
+    fprintf(fp, ", \"release\": ");
+    json_string(fp, info.host.release);
+    fprintf(fp, ", \"machine\": ");
+    json_string(fp, info.host.machine);
+    fprintf(fp, ", \"cpus\": %ld},\n", info.cpus);
+
+    fprintf(fp, "  \"heap\": {\"backing\": ");
+    json_string(fp, mem_backing_name());
+    fprintf(fp, ", \"limit_bytes\": %lu},\n", (unsigned long)mem_limit_bytes());
+
+    fprintf(fp, "  \"options\": {\"stream\": %s, \"latency\": %s, "
+	    "\"counters\": %s, \"cold\": %s, \"startup\": %d, \"touch\": ", 
+	    opts->stream ? "true" : "false", opts->latency ? "true" : "false",
+	    opts->counters ? "true" : "false", opts->cold ? "true" : "false",
+	    opts->startup);
+    json_number(fp, opts->touch);
+    fprintf(fp, ", \"locality\": %s},\n", opts->locality ? "true" : "false");
+
+    fprintf(fp, "  \"mm\": ");
+    json_stats(fp, tracefiles, n, mm_stats, opts);
+    if (nsys > 0) {
+	fprintf(fp, ",\n  \"libc\": ");
+	json_stats(fp, tracefiles, n, sys_stats[0], NULL);
+    }
+    if (nsys > 1) {
+	fprintf(fp, ",\n  \"allocators\": [");
+	for (k = 1; k < nsys; k++) {
+	    fprintf(fp, "%s\n  {\"name\": ", (k > 1) ? "," : "");
+	    json_string(fp, sys[k].name);
+	    fprintf(fp, ", \"traces\": ");
+	    json_stats(fp, tracefiles, n, sys_stats[k], NULL);
+	    fprintf(fp, "}");
+	}
+	fprintf(fp, "\n  ]");
+    }
+
+    fprintf(fp, ",\n  \"summary\": {\"errors\": %d, \"correct\": %d, "
+	    "\"util\": ", errors, numcorrect);
+    json_number(fp, avg_util);
+    fprintf(fp, ", \"kops\": ");
+    if (errors == 0)
+	json_number(fp, throughput/1e3);
+    else
+	fprintf(fp, "null");
+    fprintf(fp, ", \"libc_kops\": ");
+    if (libc_thruput > 0)
+	json_number(fp, libc_thruput/1e3);
+    else
+	fprintf(fp, "null");
+    fprintf(fp, ", \"perfindex\": ");
+    json_number(fp, perfindex);
+    fprintf(fp, "}\n}\n");
+}
+
+/*
+ * csv_string - write str as a quoted CSV field (RFC 4180), followed by
+ *    a comma, so that commas, quotes and newlines in it stay inside it
+ */
+static void csv_string(FILE *fp, char *str)
+{
+    fputc('"', fp);
+    for (; *str; str++) {
+	if (*str == '"')
+	    fputc('"', fp);
+	fputc(*str, fp);
+    }
+    fputs("\",", fp);
+}
+
+/*
+ * csv_stats - write one CSV row per trace for one package
+ */
+static void csv_stats(FILE *fp, char *engine, runinfo_t *info, 
+		      char **tracefiles, int n, stats_t *stats, 
+		      evalopts_t *opts)
+{
+    int i, j;
+    lat_t *lat;
+
+    for (i = 0; i < n; i++) {
+	csv_string(fp, info->time);
+	csv_string(fp, info->host.nodename);
+	csv_string(fp, fsecs_method());
+	csv_string(fp, mem_backing_name());
+	csv_string(fp, engine);
+	csv_string(fp, !strcmp(engine, "mm") ? team.teamname : "");
+	fprintf(fp, "%d,", i);
+	csv_string(fp, tracefiles[i]);
+	fprintf(fp, "%d", stats[i].valid);
+	if (!stats[i].valid) {
+	    fprintf(fp, ",,,,,,,");
+	    for (j = 0; j < 3 * 5 + PERFCTR_NUM + 11; j++)
+		fprintf(fp, ",");
+	    fprintf(fp, "\n");
+	    continue;
+	}
+	fprintf(fp, ",%.6f,%.0f,%.9g,%.9g,%.3f,%.0f,%.0f", stats[i].util,
+		stats[i].ops, stats[i].secs, stats[i].ci,
+		(stats[i].ops/1e3)/stats[i].secs, stats[i].heap, 
+		stats[i].resident);
+	for (j = 0; j < 3; j++) {
+	    lat = &stats[i].lat[j];
+	    if (opts && opts->latency && lat->count > 0)
+		fprintf(fp, ",%.0f,%.0f,%.0f,%.0f,%.0f", lat->p50, lat->p90,
+			lat->p99, lat->p999, lat->max);
+	    else
+		fprintf(fp, ",,,,,");
+	}
+	for (j = 0; j < PERFCTR_NUM; j++) {
+	    if (opts && opts->counters && stats[i].ctr[j] >= 0)
+		fprintf(fp, ",%.4f", stats[i].ctr[j]);
+	    else
+		fprintf(fp, ",");
+	}
+	if (opts && opts->startup)
+	    fprintf(fp, ",%.0f,%.0f,%.0f", stats[i].init_secs * 1e9,
+		    stats[i].startup_ops, stats[i].startup_secs * 1e9);
+	else
+	    fprintf(fp, ",,,");
+	if (opts && opts->touch)
+	    fprintf(fp, ",%.0f,%.9g,%.9g", stats[i].touch_blocks,
+		    stats[i].touch_alloc_secs, stats[i].touch_app_secs);
+	else
+	    fprintf(fp, ",,,");
+	if (opts && opts->locality)
+	    fprintf(fp, ",%.0f,%.1f,%.6f,%.6f,%.1f", stats[i].dist,
+		    stats[i].pages, stats[i].page_fill, stats[i].line_fill,
+		    stats[i].ws_pages);
+	else
+	    fprintf(fp, ",,,,,");
+	fprintf(fp, "\n");
+    }
+}
+
+/*
+ * write_csv - write one row per package and trace, each carrying the
+ *    run-wide facts so that rows from many runs can be concatenated.
+ *    Columns that weren't measured are left empty.
+ */
+static void write_csv(FILE *fp, char **tracefiles, int n, stats_t *mm_stats,
+		      int nsys, sysalloc_t *sys, stats_t **sys_stats,
+		      evalopts_t *opts)
+{
+    static char *opnames[3] = {"malloc", "free", "realloc"};
+    static char *latnames[5] = {"p50", "p90", "p99", "p99.9", "max"};
+    runinfo_t info;
+    int i, j;
+
+    get_runinfo(&info);
+    fprintf(fp, "time,host,timing,backing,engine,team,trace,file,valid,"
+	    "util,ops,secs,ci_secs,kops,heap_bytes,resident_bytes");
+    for (i = 0; i < 3; i++)
+	for (j = 0; j < 5; j++)
+	    fprintf(fp, ",%s_%s_ns", opnames[i], latnames[j]);
+    for (j = 0; j < PERFCTR_NUM; j++)
+	fprintf(fp, ",%s_per_op", perfctr_names[j]);
+    fprintf(fp, ",init_ns,startup_ops,startup_ns,touch_blocks,"
+	    "touch_malloc_secs,touch_app_secs,dist_bytes,pages,page_fill,"
+	    "line_fill,ws_pages\n");
+
+    csv_stats(fp, "mm", &info, tracefiles, n, mm_stats, opts);
+    for (i = 0; i < nsys; i++)
+	csv_stats(fp, sys[i].name, &info, tracefiles, n, sys_stats[i], NULL);
+}
+
+/*
+ * write_results - write the results to path ("-" for stdout) with
+ *    write_json or write_csv
+ */
+static void write_results(char *path, int json, char **tracefiles, int n,
+			  stats_t *mm_stats, int nsys, sysalloc_t *sys,
+			  stats_t **sys_stats, double libc_thruput, 
+			  evalopts_t *opts, int numcorrect, double avg_util,
+			  double throughput, double perfindex)
+{
+    FILE *fp = results_stdout;
+
+    if (strcmp(path, "-") && (fp = fopen(path, "w")) == NULL) {
+	sprintf(msg, "Could not open %s for writing", path);
+	unix_error(msg);
+    }
+    if (json)
+	write_json(fp, tracefiles, n, mm_stats, nsys, sys, sys_stats,
+		   libc_thruput, opts, numcorrect, avg_util, throughput,
+		   perfindex);
+    else
+	write_csv(fp, tracefiles, n, mm_stats, nsys, sys, sys_stats, opts);
+    if (fclose(fp) != 0)
+	unix_error("Could not write results");
+}
+
+/*
+ * parse_size - convert a byte count with an optional K, M or G suffix
+ *    (powers of 1024) to a number. Returns 0 if str is not a size or 
+ *    overflows; whether it fits a size_t is up to the caller.
+ */
+static unsigned long long parse_size(char *str)
+{
+    char *end;
+    unsigned long long bytes;
+    int shift = 0;
+
+    errno = 0;
+    bytes = strtoull(str, &end, 10);
+    if (errno || end == str)
+	return 0;
+    switch (*end) {
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    }
+    if (*end != '\0' || (bytes << shift) >> shift != bytes)
+	return 0;
+    return bytes << shift;
 }
 
 /* 
@@ -993,10 +4130,11 @@ void unix_error(char *msg)
 /*
  * malloc_error - Report an error returned by the mm_malloc package
  */
-void malloc_error(int tracenum, int opnum, char *msg)
+void malloc_error(int tracenum, uint64_t opnum, char *msg)
 {
     errors++;
-    printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
+    printf("ERROR [trace %d, line %llu]: %s\n", tracenum,
+	   (unsigned long long)LINENUM(opnum), msg);
 }
 
 /* 
@@ -1004,14 +4142,48 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValspLe] [-f <file>] [-t <dir>] [-b <backing>] [-m <size>]\n");
+    fprintf(stderr, "               [-j <n>] [-T <n>] [--json=<file>] [--csv=<file>]\n");
+    fprintf(stderr, "               [--baseline=<so> [--candidate=<so>]] [--suite=large]\n");
+    fprintf(stderr, "               [--allocator=<so> ...] [--cold] [--startup=<n>] [--touch=<f>]\n");
+    fprintf(stderr, "               [--locality] [--soak=<n>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-b <spec>  Back the heap with malloc (default) or with\n");
+    fprintf(stderr, "\t           mmap, optionally +thp and/or +populate (which\n");
+    fprintf(stderr, "\t           faults in the whole -m limit up front).\n");
+    fprintf(stderr, "\t-e         Report hardware events per request (perf_event_open).\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
-    fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-j <n>     Evaluate traces in <n> parallel worker processes.\n");
+    fprintf(stderr, "\t-l         Run libc malloc, and the other allocators found\n");
+    fprintf(stderr, "\t           (see config.h), as well.\n");
+    fprintf(stderr, "\t-L         Report latency percentiles of each request type.\n");
+    fprintf(stderr, "\t-m <size>  Maximum heap size, e.g. 512M, under 4G in the\n");
+    fprintf(stderr, "\t           32-bit driver (64G needs a 64-bit build).\n");
+    fprintf(stderr, "\t-p         Pin each -j worker to its own core.\n");
+    fprintf(stderr, "\t-s         Stream traces from disk in bounded memory (the\n");
+    fprintf(stderr, "\t           heap is still capped by -m).\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Also replay each trace's threads on 1..<n> threads\n");
+    fprintf(stderr, "\t           (needs mdriver-ts).\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t--allocator=<so>  Also run the malloc in <so>, e.g. a jemalloc (-l).\n");
+    fprintf(stderr, "\t--baseline=<so>   Compare mm.c (or --candidate) against the\n");
+    fprintf(stderr, "\t                  package in <so>, built like mm.so.\n");
+    fprintf(stderr, "\t--candidate=<so>  Compare the package in <so> instead of mm.c.\n");
+    fprintf(stderr, "\t--cold            Flush the caches before each timed run.\n");
+    fprintf(stderr, "\t--csv=<file>      Also write the results as CSV (- for stdout,\n");
+    fprintf(stderr, "\t                  with the rest of the output on stderr).\n");
+    fprintf(stderr, "\t--json=<file>     Also write the results as JSON (- for stdout,\n");
+    fprintf(stderr, "\t                  with the rest of the output on stderr).\n");
+    fprintf(stderr, "\t--locality        Report how the blocks are laid out, next to util.\n");
+    fprintf(stderr, "\t--soak=<n>        Also replay the traces <n> times on one heap.\n");
+    fprintf(stderr, "\t--startup=<n>     Also time mm_init and the first <n> requests\n");
+    fprintf(stderr, "\t                  of each trace from cold.\n");
+    fprintf(stderr, "\t--suite=large     Run the large suite (see config.h), streamed.\n");
+    fprintf(stderr, "\t--touch=<f>       Also replay writing each payload and touching\n");
+    fprintf(stderr, "\t                  <f> of the live blocks between requests.\n");
 }
@@ -14,10 +14,225 @@
 #include "memlib.h"
 #include "config.h"
 
+/* Transparent huge pages are 2 MB on the hosts we care about */
+#define HUGEPAGE_SIZE (1 << 21)
+
+/* Reserved heap space is committed this many bytes at a time */
+#define COMMIT_CHUNK HUGEPAGE_SIZE
+
+/* Region records are padded to this many bytes, keeping heaps aligned */
+#define REGION_ALIGN 16
+
+/* One simulated heap: the default one behind mem_sbrk, or a region */
+struct mem_region {
+    char *start_brk;  /* points to first byte of heap */
+    char *brk;        /* points to last byte of heap */
+    char *max_addr;   /* largest legal heap address */ 
+    char *commit_brk; /* end of the committed (usable) part */
+    int backing;      /* how the heap is backed */
+    char *map_base;   /* start of the mmap'd region (mmap backings) */
+    size_t map_len;   /* length of the mmap'd region */
+};
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static mem_region_t mem_heap;       /* the default heap */
+static size_t mem_limit = MAX_HEAP; /* maximum heap size in bytes */
+static int mem_backing = MEM_BACKING_MALLOC; /* backing for new heaps */
+
+/* 
+ * mem_set_backing - select how mem_init backs the simulated heap. spec
+ *    is "malloc", or a '+'-separated combination of "mmap", "populate"
+ *    and "thp" (e.g. "thp+populate"). Returns -1 if spec is bogus.
+ */
+int mem_set_backing(char *spec)
+{
+    char buf[64];
+    char *word;
+    int backing = 0;
+
+    if (strlen(spec) >= sizeof(buf))
+	return -1;
+    strcpy(buf, spec);
+
+    for (word = strtok(buf, "+"); word != NULL; word = strtok(NULL, "+")) {
+	if (!strcmp(word, "malloc"))
+	    backing |= MEM_BACKING_MALLOC;
+	else if (!strcmp(word, "mmap"))
+	    backing |= MEM_BACKING_MMAP;
+	else if (!strcmp(word, "populate"))
+	    backing |= MEM_BACKING_MMAP | MEM_BACKING_POPULATE;
+	else if (!strcmp(word, "thp"))
+	    backing |= MEM_BACKING_MMAP | MEM_BACKING_HUGEPAGE;
+	else
+	    return -1;
+    }
+    mem_backing = backing;
+    return 0;
+}
+
+/*
+ * mem_backing_name - describe the backing of the default heap, e.g. for
+ *    the driver's results. Options that the host refused are dropped
+ *    by mem_init, so this reports what the heap really got.
+ */
+char *mem_backing_name(void)
+{
+    static char name[64];
+    int backing = mem_heap.start_brk ? mem_heap.backing : mem_backing;
+
+    if (!(backing & MEM_BACKING_MMAP))
+	return "malloc";
+    strcpy(name, "mmap");
+    if (backing & MEM_BACKING_HUGEPAGE)
+	strcat(name, "+thp");
+    if (backing & MEM_BACKING_POPULATE)
+	strcat(name, "+populate");
+    return name;
+}
+
+/*
+ * mem_map_heap - reserve limit bytes of address space for heap r.
+ *    Nothing is usable until mem_commit makes it so; the reservation
+ *    is aligned to huge pages when they were asked for. Returns NULL
+ *    if the address space is not available.
+ */
+static char *mem_map_heap(mem_region_t *r, size_t limit)
+{
+    size_t align = (r->backing & MEM_BACKING_HUGEPAGE) ? HUGEPAGE_SIZE : 0;
+    char *base;
+
+    r->map_len = limit + align;
+    if ((base = mmap(NULL, r->map_len, PROT_NONE, 
+		     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, 
+		     -1, 0)) == MAP_FAILED)
+	return NULL;
+    r->map_base = base;
+    if (align)
+	base = (char *)(((unsigned long)base + align - 1) & ~(align - 1));
+    return base;
+}
+
+/*
+ * mem_commit - make the reserved part of heap r usable up to at least addr, 
+ *    growing the committed prefix a whole COMMIT_CHUNK at a time.
+ *    Freshly committed chunks are advised for huge pages and/or 
+ *    prefaulted as the backing asks. A populated heap is committed in
+ *    full by mem_setup, so only the other backings commit lazily from
+ *    mem_sbrk. Returns -1 on failure.
+ */
+static int mem_commit(mem_region_t *r, char *addr)
+{
+    char *new_commit;
+    size_t len, i;
+
+    if (addr <= r->commit_brk)
+	return 0;
+
+    len = (size_t)(addr - r->commit_brk);
+    len = (len + COMMIT_CHUNK - 1) & ~((size_t)COMMIT_CHUNK - 1);
+    if (len > (size_t)(r->max_addr - r->commit_brk))
+	len = (size_t)(r->max_addr - r->commit_brk);
+    new_commit = r->commit_brk + len;
+
+    if (mprotect(r->commit_brk, len, PROT_READ | PROT_WRITE) < 0)
+	return -1;
+
+    if (r->backing & MEM_BACKING_HUGEPAGE) {
+#ifdef MADV_HUGEPAGE
+	if (madvise(r->commit_brk, len, MADV_HUGEPAGE) < 0) {
+	    fprintf(stderr, "mem_init_vm: MADV_HUGEPAGE refused (%s), "
+		    "using base pages\n", strerror(errno));
+	    r->backing &= ~MEM_BACKING_HUGEPAGE;
+	}
+#else
+	r->backing &= ~MEM_BACKING_HUGEPAGE;
+#endif
+    }
+
+    /* Fault the pages in (mem_setup commits all of them at once) */
+    if (r->backing & MEM_BACKING_POPULATE)
+	for (i = 0; i < len; i += mem_pagesize())
+	    r->commit_brk[i] = 0;
+
+    r->commit_brk = new_commit;
+    return 0;
+}
+
+/*
+ * mem_set_limit - set the maximum heap size used by the next mem_init.
+ *    With an mmap backing only address space is reserved up front, so 
+ *    the limit may be far larger than physical memory.
+ */
+void mem_set_limit(size_t bytes)
+{
+    mem_limit = bytes;
+}
+
+/*
+ * mem_limit_bytes - return the maximum heap size
+ */
+size_t mem_limit_bytes(void)
+{
+    return mem_limit;
+}
+
+/*
+ * mem_limit_max - return the largest limit a heap may have: room is
+ *    left for a region's reserved prefix and for aligning the heap to
+ *    huge pages, so that the sizes mem_setup adds up can't wrap
+ */
+size_t mem_limit_max(void)
+{
+    return (size_t)-1 - 2 * (size_t)HUGEPAGE_SIZE;
+}
+
+/*
+ * mem_setup - give heap r storage for limit bytes plus a reserved 
+ *    prefix of hdr bytes, using the current backing. A populated heap
+ *    is committed and faulted in whole here, so that mem_sbrk, which
+ *    runs inside the timed runs, never takes a page fault. Returns the
+ *    start of the storage, or NULL if it could not be had.
+ */
+static char *mem_setup(mem_region_t *r, size_t limit, size_t hdr)
+{
+    char *base, *commit;
+
+    if (limit > (size_t)-1 - hdr - HUGEPAGE_SIZE) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    r->backing = mem_backing;
+    if (r->backing & MEM_BACKING_MMAP) {
+	if ((base = mem_map_heap(r, limit + hdr)) == NULL)
+	    return NULL;
+	r->commit_brk = base;
+	r->max_addr = base + hdr + limit;
+	commit = (r->backing & MEM_BACKING_POPULATE) ? r->max_addr : base + hdr;
+	if (mem_commit(r, commit) < 0) {
+	    munmap(r->map_base, r->map_len);
+	    return NULL;
+	}
+    }
+    else {
+	if ((base = (char *)malloc(limit + hdr)) == NULL)
+	    return NULL;
+	/* A malloc'd heap is usable in full from the start */
+	r->max_addr = r->commit_brk = base + hdr + limit;
+    }
+    r->start_brk = r->brk = base + hdr;      /* heap is empty initially */
+    return base;
+}
+
+/*
+ * mem_teardown - give back all of the storage behind heap r
+ */
+static void mem_teardown(mem_region_t *r, char *base)
+{
+    if (r->backing & MEM_BACKING_MMAP)
+	munmap(r->map_base, r->map_len);
+    else
+	free(base);
+}
 
 /* 
  * mem_init - initialize the memory system model
@@ -25,13 +240,11 @@ static char *mem_max_addr;   /* largest legal heap address */
 void mem_init(void)
 {
     /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    if (mem_setup(&mem_heap, mem_limit, 0) == NULL) {
+	fprintf(stderr, "mem_init_vm: cannot get %lu bytes of heap: %s\n",
+		(unsigned long)mem_limit, strerror(errno));
 	exit(1);
     }
-
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
 }
 
 /* 
@@ -39,7 +252,8 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    mem_teardown(&mem_heap, mem_heap.start_brk);
+    mem_heap.start_brk = NULL;
 }
 
 /*
@@ -47,7 +261,21 @@ void mem_deinit(void)
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    mem_heap.brk = mem_heap.start_brk;
+}
+
+/*
+ * mem_reset_heap - like mem_reset_brk, but also give the OS back the
+ *    physical memory behind the old heap, so that none of it is still
+ *    resident when the next heap grows over it. A populated heap keeps
+ *    its pages, since it is there to never fault.
+ */
+void mem_reset_heap(void)
+{
+    if (!(mem_heap.backing & MEM_BACKING_POPULATE))
+	mem_release(mem_heap.start_brk, 
+		    (size_t)(mem_heap.commit_brk - mem_heap.start_brk));
+    mem_heap.brk = mem_heap.start_brk;
 }
 
 /* 
@@ -55,16 +283,55 @@ void mem_reset_brk()
  *    by incr bytes and returns the start address of the new area. In
  *    this model, the heap cannot be shrunk.
  */
-void *mem_sbrk(int incr) 
+void *mem_sbrk(int64_t incr) 
+{
+    return mem_region_sbrk(&mem_heap, incr);
+}
+
+/*
+ * mem_region_create - create a heap of its own, independent of the 
+ *    default heap and of every other region, that can hold up to limit
+ *    bytes. The region record lives in front of the heap it describes,
+ *    so nothing outside the region's own storage is allocated. Returns
+ *    NULL if the storage is not available.
+ */
+mem_region_t *mem_region_create(size_t limit)
 {
-    char *old_brk = mem_brk;
+    mem_region_t r;
+    char *base;
+    size_t hdr = (sizeof(mem_region_t) + REGION_ALIGN - 1) & ~(REGION_ALIGN - 1);
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if ((base = mem_setup(&r, limit, hdr)) == NULL)
+	return NULL;
+    memcpy(base, &r, sizeof(r));
+    return (mem_region_t *)base;
+}
+
+/*
+ * mem_region_destroy - drop region r and every byte allocated from it
+ *    in one step
+ */
+void mem_region_destroy(mem_region_t *r)
+{
+    mem_region_t copy = *r;  /* r itself is about to disappear */
+
+    mem_teardown(&copy, (char *)r);
+}
+
+/*
+ * mem_region_sbrk - mem_sbrk for heap r
+ */
+void *mem_region_sbrk(mem_region_t *r, int64_t incr) 
+{
+    char *old_brk = r->brk;
+
+    if ((incr < 0) || ((uint64_t)incr > (uint64_t)(r->max_addr - r->brk)) ||
+	(mem_commit(r, r->brk + incr) < 0)) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
-    mem_brk += incr;
+    r->brk += incr;
     return (void *)old_brk;
 }
 
@@ -73,7 +340,7 @@ void *mem_sbrk(int incr)
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return (void *)mem_heap.start_brk;
 }
 
 /* 
@@ -81,7 +348,7 @@ void *mem_heap_lo()
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return (void *)(mem_heap.brk - 1);
 }
 
 /*
@@ -89,7 +356,7 @@ void *mem_heap_hi()
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return (size_t)(mem_heap.brk - mem_heap.start_brk);
 }
 
 /*
@@ -99,3 +366,51 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_release - hint that the pages lying wholly inside [addr, addr+len)
+ *    hold nothing of value. They stay inside the heap (the brk does not
+ *    move) but the OS may take back their physical memory; they read as
+ *    zeros (or as their old contents, under MADV_FREE) when next touched.
+ *    Returns the number of bytes released.
+ */
+size_t mem_release(void *addr, size_t len)
+{
+    size_t pagesize = mem_pagesize();
+    unsigned long lo = ((unsigned long)addr + pagesize - 1) & ~(pagesize - 1);
+    unsigned long hi = ((unsigned long)addr + len) & ~(pagesize - 1);
+
+    if (hi <= lo)
+	return 0;
+    if (madvise((void *)lo, hi - lo, RELEASE_ADVICE) < 0)
+	return 0;
+    return (size_t)(hi - lo);
+}
+
+/*
+ * mem_resident_pages - return how many pages between the start of the
+ *    heap and the brk are currently resident in physical memory
+ */
+size_t mem_resident_pages(void)
+{
+    static unsigned char *vec = NULL;  /* one mincore byte per page */
+    static size_t veclen = 0;
+    size_t pagesize = mem_pagesize();
+    unsigned long lo = (unsigned long)mem_heap.start_brk & ~(pagesize - 1);
+    size_t npages = ((unsigned long)mem_heap.brk - lo + pagesize - 1) / pagesize;
+    size_t i, resident = 0;
+
+    if (npages > veclen) {
+	free(vec);
+	if ((vec = malloc(npages)) == NULL) {
+	    veclen = 0;
+	    return 0;
+	}
+	veclen = npages;
+    }
+    if (npages == 0 || mincore((void *)lo, npages * pagesize, (void *)vec) < 0)
+	return 0;
+    for (i = 0; i < npages; i++)
+	resident += vec[i] & 1;
+    return resident;
+}
@@ -1,11 +1,31 @@
 #include <unistd.h>
+#include <stdint.h>
+
+/* Heap backings, combined by mem_set_backing() */
+#define MEM_BACKING_MALLOC   0x0  /* plain malloc of the whole heap (default) */
+#define MEM_BACKING_MMAP     0x1  /* anonymous mmap */
+#define MEM_BACKING_POPULATE 0x2  /* prefault pages as they are committed */
+#define MEM_BACKING_HUGEPAGE 0x4  /* advise transparent huge pages */
+
+/* An independent simulated heap (see mem_region_create) */
+typedef struct mem_region mem_region_t;
 
 void mem_init(void);               
 void mem_deinit(void);
-void *mem_sbrk(int incr);
+int mem_set_backing(char *spec);
+char *mem_backing_name(void);
+void mem_set_limit(size_t bytes);
+size_t mem_limit_bytes(void);
+size_t mem_limit_max(void);
+void *mem_sbrk(int64_t incr);
 void mem_reset_brk(void); 
+void mem_reset_heap(void);
+mem_region_t *mem_region_create(size_t limit);
+void mem_region_destroy(mem_region_t *r);
+void *mem_region_sbrk(mem_region_t *r, int64_t incr);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
-
+size_t mem_release(void *addr, size_t len);
+size_t mem_resident_pages(void);
@@ -11,6 +11,9 @@
 #include <errno.h>
 #include "mm.h"
 #include "memlib.h"
+#ifdef MM_THREAD_SAFE
+#include <pthread.h>
+#endif
 
 team_t team = {
     /* Team name */
@@ -39,6 +42,10 @@ team_t team = {
 #define PRED_FIELD_SIZE 1 // 단위: word
 #define EPILOG_SIZE 2     // 단위: word
 #define ALIGNMENT 8
+#define PURGED 2                   // 페이지를 OS에 반환한 가용 블록임을 표시하는 상태 비트
+#define AGED 4                     // 직전 purge_free_blocks 때 이미 가용 상태였던 블록임을 표시하는 상태 비트
+#define PURGE_MIN_WORDS (1 << 14)  // 이 사이즈(64KB) 이상의 가용 블록만 페이지를 반환함 (단위: word)
+#define PURGE_INTERVAL 256         // free가 이 횟수만큼 호출될 때마다 가용 블록의 페이지 반환을 시도함
 
 /*************************************** 매크로 **********************************************/
 
@@ -63,6 +70,12 @@ team_t team = {
 /* 블록의 할당 여부 가져오기 */
 #define GET_STATUS(p) (GET_WORD(p) & 0x1)
 
+/* 가용 블록의 페이지를 이미 OS에 반환했는지 여부 가져오기 */
+#define GET_PURGED(p) (GET_WORD(p) & PURGED)
+
+/* 가용 블록이 직전 purge_free_blocks 이후로 계속 가용 상태였는지 여부 가져오기 */
+#define GET_AGED(p) (GET_WORD(p) & AGED)
+
 /*
  * 블록의 크기와 할당 비트를 통합해서 header와 footer에 저장할 수 있는 값 만들기
  * Pack a size and allocated bit into a word
@@ -81,10 +94,10 @@ team_t team = {
 #define GET_TOTAL_SIZE(p) (GET_SIZE(p) + HDR_FTR_SIZE)
 
 /* free_lists의 i번째 요소 가져오기 */
-#define GET_FREE_LIST_PTR(i) (*(free_lists + i))
+#define GET_FREE_LIST_PTR(i) (*(heap->free_lists + i))
 
 /* free_lists의 i번째 요소 값 설정하기 */
-#define SET_FREE_LIST_PTR(i, ptr) (*(free_lists + i) = ptr)
+#define SET_FREE_LIST_PTR(i, ptr) (*(heap->free_lists + i) = ptr)
 
 /* 가용 블록의 predecessor, successor 주소값 셋팅 */
 #define SET_PTR(p, ptr) (*(char **)(p) = (char *)(ptr))
@@ -107,11 +120,40 @@ team_t team = {
 /* 다음 블록의 포인터 가져오기 */
 #define NEXT_BLOCK_IN_HEAP(header_p) (FTRP(header_p) + FTR_SIZE)
 
+/* 현재 힙의 영역 확장하기 (기본 힙은 memlib의 기본 힙을 사용) */
+#define HEAP_SBRK(incr) (heap->region == NULL ? mem_sbrk(incr) : mem_region_sbrk(heap->region, incr))
+
 /************************************** 변수 선언부 *******************************************/
 
-static char **free_lists;
-static char **heap_ptr;
-static int previous_size;
+/* 힙 핸들: 힙마다 자신의 memlib 영역과 segregated free list를 가짐 */
+struct mm_heap
+{
+    mem_region_t *region;    // 힙이 사용하는 memlib 영역 (기본 힙은 NULL)
+    char **free_lists;       // segregated free list
+    char **heap_ptr;         // 프롤로그 블록 다음 위치
+    int previous_size;       // 직전 mm_realloc 요청 사이즈
+    unsigned int free_count; // purge_free_blocks 호출 시점을 정하기 위한 free 호출 횟수
+};
+
+static mm_heap_t default_heap; // mm_malloc, mm_free, mm_realloc이 사용하는 기본 힙
+static mm_heap_t *heap = &default_heap; // 현재 작업 중인 힙 (mm_heap_* 함수가 호출되는 동안에만 바뀜)
+
+/*
+스레드 안전 빌드 (-DMM_THREAD_SAFE)
+- 모든 힙이 하나의 잠금을 공유함 (heap 포인터를 바꿔 끼우는 mm_heap_* 함수도 보호해야 하므로)
+- mm_realloc이 mm_malloc, mm_free를 호출하는 것처럼 잠금이 중첩될 수 있어서, 스레드마다 중첩 깊이를 세고 가장 바깥에서만 잠금/해제함
+*/
+#ifdef MM_THREAD_SAFE
+static pthread_mutex_t mm_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread int mm_lock_depth;
+#define MM_LOCK() (mm_lock_depth++ == 0 ? pthread_mutex_lock(&mm_lock) : 0)
+#define MM_UNLOCK() (--mm_lock_depth == 0 ? pthread_mutex_unlock(&mm_lock) : 0)
+int mm_thread_safe = 1;
+#else
+#define MM_LOCK()
+#define MM_UNLOCK()
+int mm_thread_safe = 0;
+#endif
 
 /************************************** 함수 선언부 *******************************************/
 
@@ -124,6 +166,8 @@ static void *find_free_block(size_t words);
 static void alloc_free_block(void *bp, size_t words);
 static void remove_block_from_free_list(char **bp);
 static void *coalesce(void *bp);
+static void purge_free_blocks(void);
+static void *malloc_block(size_t size);
 void *mm_realloc_wrapped(void *ptr, size_t size, int buffer_size);
 
 /************************************** 함수 구현부 *******************************************/
@@ -132,7 +176,7 @@ void *mm_realloc_wrapped(void *ptr, size_t size, int buffer_size);
 int mm_init(void)
 {
     // segregated free list를 위해 MAX_POWER * sizeof(char *) 만큼 힙 영역 확장하기
-    if ((long)(free_lists = mem_sbrk(MAX_POWER * sizeof(char *))) == -1)
+    if ((long)(heap->free_lists = HEAP_SBRK(MAX_POWER * sizeof(char *))) == -1)
         return -1;
 
     // segregated free list 초기화
@@ -142,20 +186,20 @@ int mm_init(void)
     }
 
     // 더블 워드 정렬 조건 충족을 위해 워드 사이즈만큼 힙 영역 확장
-    mem_sbrk(WORD_SIZE);
+    HEAP_SBRK(WORD_SIZE);
 
     // 프롤로그 블록과 에필로그 블록을 위해 힙 영역 추가 확장
-    if ((long)(heap_ptr = mem_sbrk(4 * WORD_SIZE)) == -1)
+    if ((long)(heap->heap_ptr = HEAP_SBRK(4 * WORD_SIZE)) == -1)
         return -1;
 
-    PUT_WORD(heap_ptr, PACK(0, TAKEN));       // 프롤로그 헤더
-    PUT_WORD(FTRP(heap_ptr), PACK(0, TAKEN)); // 프롤로그 푸터
+    PUT_WORD(heap->heap_ptr, PACK(0, TAKEN));       // 프롤로그 헤더
+    PUT_WORD(FTRP(heap->heap_ptr), PACK(0, TAKEN)); // 프롤로그 푸터
 
-    char **epilog = NEXT_BLOCK_IN_HEAP(heap_ptr); // 에필로그 헤더 포인터
+    char **epilog = NEXT_BLOCK_IN_HEAP(heap->heap_ptr); // 에필로그 헤더 포인터
     PUT_WORD(epilog, PACK(0, TAKEN));             // 에필로그 헤더
     PUT_WORD(FTRP(epilog), PACK(0, TAKEN));       // 에필로그 푸터
 
-    heap_ptr = NEXT_BLOCK_IN_HEAP(heap_ptr); // heap 포인터를 프롤로그 블록 다음으로 이동시킴
+    heap->heap_ptr = NEXT_BLOCK_IN_HEAP(heap->heap_ptr); // heap 포인터를 프롤로그 블록 다음으로 이동시킴
 
     // CHUNK 사이즈만큼 힙 영역을 확장하기
     char **new_block;
@@ -170,6 +214,18 @@ int mm_init(void)
 
 /* mm_malloc: 메모리 할당하기 */
 void *mm_malloc(size_t size)
+{
+    void *bp;
+
+    MM_LOCK();
+    bp = malloc_block(size);
+    MM_UNLOCK();
+
+    return bp;
+}
+
+/* malloc_block: mm_malloc의 helper function (잠금은 호출하는 쪽에서 잡음) */
+static void *malloc_block(size_t size)
 {
     if (size == 0)
         return NULL;
@@ -206,6 +262,8 @@ void *mm_malloc(size_t size)
 /* mm_free: 메모리 반환하기 */
 void mm_free(void *ptr)
 {
+    MM_LOCK();
+
     ptr -= WORD_SIZE; // 헤더 포인터
 
     // 헤더와 푸터의 할당 상태 정보를 free 상태로 수정
@@ -218,13 +276,22 @@ void mm_free(void *ptr)
 
     // 연결된 블록을 가용 리스트에 추가
     place_block_into_free_list(ptr);
+
+    // 주기적으로 큰 가용 블록의 페이지를 OS에 반환
+    if (++heap->free_count % PURGE_INTERVAL == 0)
+        purge_free_blocks();
+
+    MM_UNLOCK();
 }
 
 /* mm_realloc: 메모리 재할당하기 */
 void *mm_realloc(void *ptr, size_t size)
 {
     int buffer_size;
-    int diff = abs(size - previous_size);
+
+    MM_LOCK();
+
+    int diff = abs(size - heap->previous_size);
 
     if (diff < CHUNK * WORD_SIZE && diff % round_up_power_2(diff)) // diff가 4KB보다 작은 경우
     {
@@ -237,11 +304,173 @@ void *mm_realloc(void *ptr, size_t size)
 
     void *return_value = mm_realloc_wrapped(ptr, size, buffer_size);
 
-    previous_size = size;
+    heap->previous_size = size;
+
+    MM_UNLOCK();
 
     return return_value;
 }
 
+/*
+mm_memalign: alignment 바이트 경계에 정렬된 메모리 할당하기
+- alignment는 2의 제곱이어야 하고, ALIGNMENT 이하이면 mm_malloc과 같음
+- alignment만큼 더 크게 할당한 뒤, 정렬된 주소 앞의 남는 부분은 가용 블록으로 떼어 내고 뒤의 남는 부분은 alloc_free_block으로 돌려줌
+- 앞부분이 독립된 가용 블록이 되려면 헤더, predecessor, successor, 푸터를 위한 4워드가 필요하므로, 정렬된 페이로드는 블록 시작에서 최소 4워드 뒤에 둠
+*/
+void *mm_memalign(size_t alignment, size_t size)
+{
+    char **bp;
+    char **aligned;
+    size_t words, lead;
+
+    if (alignment <= ALIGNMENT)
+        return mm_malloc(size);
+    if (size == 0)
+        return NULL;
+
+    MM_LOCK();
+
+    if ((bp = malloc_block(size + alignment + 4 * WORD_SIZE)) == NULL)
+    {
+        MM_UNLOCK();
+        return NULL;
+    }
+
+    if (((unsigned long)bp & (alignment - 1)) != 0) // 이미 정렬되어 있지 않은 경우에만 앞부분을 떼어 냄
+    {
+        bp -= HDR_SIZE; // 헤더 포인터
+        words = GET_SIZE(bp);
+        aligned = (char **)(((unsigned long)(bp + HDR_SIZE + 4) + alignment - 1) & ~(alignment - 1));
+        lead = aligned - HDR_SIZE - bp; // 떼어 낼 앞부분의 사이즈 (헤더, 푸터 포함, 단위: word)
+        words -= lead;                  // 정렬된 블록의 사이즈
+        lead -= HDR_FTR_SIZE;           // 앞부분 블록의 사이즈 (헤더, 푸터 제외)
+
+        // 정렬된 주소부터 시작하는 할당 블록
+        PUT_WORD(aligned - HDR_SIZE, PACK(words, TAKEN));
+        PUT_WORD(FTRP(aligned - HDR_SIZE), PACK(words, TAKEN));
+
+        // 앞부분은 가용 블록으로 만들어 가용 리스트에 추가
+        PUT_WORD(bp, PACK(lead, FREE));
+        PUT_WORD(FTRP(bp), PACK(lead, FREE));
+        place_block_into_free_list(coalesce(bp));
+
+        bp = aligned;
+    }
+
+    // 필요한 사이즈보다 남는 뒷부분 돌려주기
+    alloc_free_block(bp - HDR_SIZE, ALIGN(size) / WORD_SIZE);
+
+    MM_UNLOCK();
+
+    return bp;
+}
+
+/* mm_usable_size: 할당된 블록에서 실제로 쓸 수 있는 바이트 수 가져오기 (요청한 사이즈 이상) */
+size_t mm_usable_size(void *ptr)
+{
+    size_t size;
+
+    if (ptr == NULL)
+        return 0;
+
+    MM_LOCK();
+    size = GET_SIZE((char **)ptr - HDR_SIZE) * WORD_SIZE;
+    MM_UNLOCK();
+
+    return size;
+}
+
+/*
+mm_heap_create: 독립된 힙 만들기
+- 새 memlib 영역을 만들고, 힙 핸들을 영역의 맨 앞에 둔 뒤 그 뒤에 mm_init과 같은 방식으로 힙을 초기화함
+- max_bytes가 0이면 memlib의 기본 최대 힙 사이즈를 사용함
+- 실패하면 NULL을 리턴
+*/
+mm_heap_t *mm_heap_create(size_t max_bytes)
+{
+    mem_region_t *region;
+    mm_heap_t *h;
+    mm_heap_t *saved;
+    int result;
+
+    if ((region = mem_region_create(max_bytes ? max_bytes : mem_limit_bytes())) == NULL)
+        return NULL;
+
+    // 힙 핸들도 영역 안에 두어야 mm_heap_destroy에서 영역만 버리면 됨 (ALIGN으로 이후 블록의 정렬을 유지)
+    if ((long)(h = mem_region_sbrk(region, ALIGN(sizeof(mm_heap_t)))) == -1)
+    {
+        mem_region_destroy(region);
+        return NULL;
+    }
+    memset(h, 0, sizeof(mm_heap_t));
+    h->region = region;
+
+    MM_LOCK();
+    saved = heap;
+    heap = h;
+    result = mm_init();
+    heap = saved;
+    MM_UNLOCK();
+
+    if (result < 0)
+    {
+        mem_region_destroy(region);
+        return NULL;
+    }
+    return h;
+}
+
+/* mm_heap_destroy: 힙과 그 힙에서 할당된 모든 블록을 한 번에 해제하기 (블록을 하나씩 순회하지 않음) */
+void mm_heap_destroy(mm_heap_t *h)
+{
+    mem_region_destroy(h->region);
+}
+
+/* mm_heap_malloc: 주어진 힙에서 메모리 할당하기 */
+void *mm_heap_malloc(mm_heap_t *h, size_t size)
+{
+    mm_heap_t *saved;
+    void *bp;
+
+    MM_LOCK();
+    saved = heap;
+    heap = h;
+    bp = mm_malloc(size);
+    heap = saved;
+    MM_UNLOCK();
+
+    return bp;
+}
+
+/* mm_heap_free: 주어진 힙에 메모리 반환하기 */
+void mm_heap_free(mm_heap_t *h, void *ptr)
+{
+    mm_heap_t *saved;
+
+    MM_LOCK();
+    saved = heap;
+    heap = h;
+    mm_free(ptr);
+    heap = saved;
+    MM_UNLOCK();
+}
+
+/* mm_heap_realloc: 주어진 힙에서 메모리 재할당하기 */
+void *mm_heap_realloc(mm_heap_t *h, void *ptr, size_t size)
+{
+    mm_heap_t *saved;
+    void *bp;
+
+    MM_LOCK();
+    saved = heap;
+    heap = h;
+    bp = mm_realloc(ptr, size);
+    heap = saved;
+    MM_UNLOCK();
+
+    return bp;
+}
+
 /*
 mm_realloc_wrapped: mm_realloc의 helper function
 - ptr이 NULL인 경우 mm_malloc 수행
@@ -327,7 +556,7 @@ static void *extend_heap(size_t words)
     size_t words_extend = EVENIZE(words);                    // 더블 워드 정렬
     size_t words_extend_total = words_extend + HDR_FTR_SIZE; // 헤더와 푸터 사이즈를 더한 총 블록 사이즈
 
-    if ((long)(bp = mem_sbrk((words_extend_total)*WORD_SIZE)) == -1)
+    if ((long)(bp = HEAP_SBRK((words_extend_total)*WORD_SIZE)) == -1)
         return NULL;
 
     // 힙 영역 마지막에 에필로그 블록 추가
@@ -587,4 +816,38 @@ static void *coalesce(void *bp)
     }
 
     return bp;
-}
\ No newline at end of file
+}
+
+/*
+purge_free_blocks: 큰 가용 블록의 페이지를 OS에 반환하기
+- free 직후가 아니라 PURGE_INTERVAL번의 free마다 한 번씩 수행함
+- 처음 본 가용 블록은 AGED 비트로 표시만 하고, 다음 호출 때까지 그 표시가 남아 있는 블록만 반환함
+  (블록이 할당되거나 연결되면 헤더가 새로 쓰이면서 비트가 지워지므로, 그 사이에 재사용된 블록은 반환되지 않음)
+- 한 번 반환한 블록은 PURGED 비트로 표시해서 다시 반환하지 않음
+- brk는 그대로 두고, 블록 헤더/predecessor/successor와 푸터를 제외한 안쪽 페이지만 반환함
+*/
+static void purge_free_blocks(void)
+{
+    char **bp;
+    size_t index;
+
+    for (index = find_free_list_index(PURGE_MIN_WORDS); index <= MAX_POWER; index++)
+    {
+        // 가용 리스트는 내림차순으로 정렬되어 있으므로 작은 블록을 만나면 중단
+        for (bp = GET_FREE_LIST_PTR(index); bp != NULL && GET_SIZE(bp) >= PURGE_MIN_WORDS; bp = GET_SUCC(bp))
+        {
+            if (GET_PURGED(bp))
+                continue;
+
+            // 이번에 처음 본 블록은 표시만 해 두고, 다음 호출까지 쓰이지 않으면 반환
+            if (!GET_AGED(bp))
+            {
+                PUT_WORD(bp, PACK(GET_SIZE(bp), FREE | AGED));
+                continue;
+            }
+
+            mem_release(GET_PTR_SUCC_FIELD(bp) + 1, (GET_SIZE(bp) - 2 * PRED_FIELD_SIZE) * WORD_SIZE);
+            PUT_WORD(bp, PACK(GET_SIZE(bp), FREE | AGED | PURGED));
+        }
+    }
+}
@@ -1,9 +1,29 @@
+#ifndef __MM_H_
+#define __MM_H_
+
 #include <stdio.h>
 
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_memalign(size_t alignment, size_t size);
+extern size_t mm_usable_size(void *ptr);
+
+/*
+ * Independent heaps. Each heap has its own memlib region and free
+ * lists; mm_heap_destroy drops the heap and all of its blocks at once.
+ */
+typedef struct mm_heap mm_heap_t;
+
+extern mm_heap_t *mm_heap_create(size_t max_bytes);
+extern void mm_heap_destroy(mm_heap_t *heap);
+extern void *mm_heap_malloc(mm_heap_t *heap, size_t size);
+extern void mm_heap_free(mm_heap_t *heap, void *ptr);
+extern void *mm_heap_realloc(mm_heap_t *heap, void *ptr, size_t size);
+
+/* Nonzero if mm.c was built with -DMM_THREAD_SAFE */
+extern int mm_thread_safe;
 
 
 /* 
@@ -21,3 +41,4 @@ typedef struct {
 
 extern team_t team;
 
+#endif /* __MM_H_ */
@@ -0,0 +1,696 @@
+/*
+ * mmrecord.c - record the allocator requests of any program as a trace
+ *
+ * Preloaded into a process, this library passes each malloc, calloc,
+ * realloc, free, memalign, posix_memalign, aligned_alloc, valloc and
+ * pvalloc on to the real allocator and records it. When the process
+ * exits, the recording becomes a trace file in the format described
+ * in traces/README:
+ *
+ *     unix> LD_PRELOAD=./mmrecord.so MMRECORD_FILE=ls.rep ls -l
+ *     unix> mdriver -V -f ls.rep
+ *
+ * The environment controls the recording:
+ *
+ *     MMRECORD_FILE     trace to write (default mmrecord-<pid>.rep)
+ *     MMRECORD_THREADS  if set, mark the thread behind each request
+ *                       with "t <tid>" lines
+ *     MMRECORD_TIMES    if set, also write <file>.times, holding the
+ *                       time of each request in the trace, in ns since
+ *                       the recording started, one per line
+ *
+ * Each thread appends its requests to a buffer of its own, without
+ * locks or shared counters, and writes the buffer to <file>.raw in a
+ * single write() when it fills. Every request is stamped with
+ * CLOCK_MONOTONIC, which all CPUs agree on: a free is stamped before
+ * the block goes back to the allocator and an allocation after it
+ * comes out (a realloc is stamped both ways), so sorting the stamps
+ * orders the requests on any one address the way the allocator saw
+ * them. The ids in the trace are given out by address in that order.
+ *
+ * The trace can only show what mdriver can replay. Alignment requests
+ * become plain allocations, malloc(0) becomes a 1-byte allocation,
+ * realloc(p, 0) becomes a free, and requests that fail are left out.
+ * Blocks still allocated at exit are freed at the end of the trace,
+ * so that the trace is balanced. A process that doesn't exit normally
+ * (a crash, _exit or exec) leaves only the .raw file behind.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define REC_BUFSIZE (1 << 14)  /* requests per thread buffer */
+#define BOOT_BYTES  (1 << 16)  /* for allocations before dlsym returns */
+#define MAP_MIN     1024       /* initial number of address map slots */
+
+/* Keep preloaded TLS in the static block; __tls_get_addr may malloc */
+#define TLS __thread __attribute__((tls_model("initial-exec")))
+
+/* Kinds of recorded request */
+#define REC_ALLOC   0
+#define REC_FREE    1
+#define REC_REALLOC 2
+
+/* One recorded request, as written to the .raw file */
+typedef struct {
+    uint64_t start;    /* ns when it was made (frees and reallocs) */
+    uint64_t end;      /* ns when it returned (allocs and reallocs) */
+    uint64_t ptr;      /* the block it allocated or freed */
+    uint64_t old;      /* realloc: the block it replaced */
+    uint64_t size;     /* bytes requested */
+    uint32_t type;     /* REC_* */
+    uint32_t tid;      /* thread that made it */
+} rec_t;
+
+/* A thread's buffer of requests not yet written */
+typedef struct recbuf {
+    rec_t recs[REC_BUFSIZE];
+    int count;
+    uint32_t tid;
+    struct recbuf *next;   /* every thread's buffer, for the last flush */
+} recbuf_t;
+
+/* The moment a recorded request takes effect on its address */
+typedef struct {
+    uint64_t ns;
+    uint32_t rec;          /* index of the request in the recording */
+    uint32_t acquire;      /* 1 if a block is obtained, 0 if given back */
+} point_t;
+
+/* A request of the finished trace */
+typedef struct {
+    int type;              /* REC_* */
+    int id;
+    uint64_t size;
+    uint32_t tid;
+    uint64_t ns;
+} traceop_t;
+
+/* Maps live block addresses to trace ids */
+typedef struct {
+    uint64_t *keys;        /* addresses, 0 if the slot is unused */
+    int *ids;
+    size_t mask;           /* number of slots - 1 */
+    size_t live;           /* number of slots in use */
+} addrmap_t;
+
+/* The real allocator */
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+static void *(*real_memalign)(size_t, size_t);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+static void *(*real_valloc)(size_t);
+static void *(*real_pvalloc)(size_t);
+
+/* Memory handed out while dlsym is looking up the real allocator */
+static char boot[BOOT_BYTES] __attribute__((aligned(16)));
+static size_t boot_used;
+static int finding;
+
+/* The recording */
+static int recording;      /* set while requests are being recorded */
+static pid_t owner;        /* process being recorded */
+static int rawfd = -1;     /* the .raw file */
+static uint64_t t0;        /* CLOCK_MONOTONIC when the recording started */
+static char path[PATH_MAX];/* the trace */
+static int with_threads;   /* MMRECORD_THREADS */
+static int with_times;     /* MMRECORD_TIMES */
+static recbuf_t *buffers;  /* every thread's buffer */
+static uint32_t nthreads;  /* number of threads that have recorded */
+static TLS recbuf_t *mybuf;
+
+/*****************************************
+ * Finding the real allocator and recording
+ *****************************************/
+
+/*
+ * boot_alloc - hand out zeroed memory from boot[] for the allocations
+ *    dlsym makes before the real allocator is known
+ */
+static void *boot_alloc(size_t size)
+{
+    void *p;
+
+    size = (size + 15) & ~(size_t)15;
+    if (boot_used + size > BOOT_BYTES)
+	return NULL;
+    p = boot + boot_used;
+    boot_used += size;
+    return p;
+}
+
+#define IS_BOOT(p) ((char *)(p) >= boot && (char *)(p) < boot + BOOT_BYTES)
+
+/*
+ * find_real - look up the allocator the process would have used
+ */
+static void find_real(void)
+{
+    finding = 1;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_memalign = dlsym(RTLD_NEXT, "memalign");
+    real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+    real_valloc = dlsym(RTLD_NEXT, "valloc");
+    real_pvalloc = dlsym(RTLD_NEXT, "pvalloc");
+    finding = 0;
+    if (real_malloc == NULL || real_calloc == NULL ||
+	real_realloc == NULL || real_free == NULL) {
+	fprintf(stderr, "mmrecord: can't find the real allocator\n");
+	abort();
+    }
+}
+
+/*
+ * now - return the ns since the recording started
+ */
+static inline uint64_t now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec - t0;
+}
+
+/*
+ * flush - write out a thread's buffered requests in one piece. The
+ *    .raw file is opened with O_APPEND, so buffers written by several
+ *    threads at once don't interleave.
+ */
+static void flush(recbuf_t *b)
+{
+    char *p = (char *)b->recs;
+    size_t left = b->count * sizeof(rec_t);
+    ssize_t n;
+
+    while (left > 0 && (n = write(rawfd, p, left)) > 0) {
+	p += n;
+	left -= n;
+    }
+    b->count = 0;
+}
+
+/*
+ * new_buffer - give the calling thread a buffer of its own, and add
+ *    it to the list of buffers without taking a lock
+ */
+static recbuf_t *new_buffer(void)
+{
+    recbuf_t *b;
+
+    b = mmap(NULL, sizeof(recbuf_t), PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (b == MAP_FAILED)
+	return NULL;
+    b->tid = __atomic_fetch_add(&nthreads, 1, __ATOMIC_RELAXED);
+    b->next = __atomic_load_n(&buffers, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&buffers, &b->next, b, 1,
+					__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+	;
+    return mybuf = b;
+}
+
+/*
+ * record - append a request to the calling thread's buffer
+ */
+static void record(int type, uint64_t start, uint64_t end, void *ptr,
+		   void *old, size_t size)
+{
+    recbuf_t *b = mybuf;
+    rec_t *r;
+
+    if (b == NULL && (b = new_buffer()) == NULL)
+	return;
+    r = &b->recs[b->count];
+    r->start = start;
+    r->end = end;
+    r->ptr = (uintptr_t)ptr;
+    r->old = (uintptr_t)old;
+    r->size = size;
+    r->type = type;
+    r->tid = b->tid;
+    if (++b->count == REC_BUFSIZE)
+	flush(b);
+}
+
+/*
+ * stop_in_child - a forked child is not part of the recording
+ */
+static void stop_in_child(void)
+{
+    recording = 0;
+}
+
+/*
+ * rec_init - start recording when the library is loaded
+ */
+__attribute__((constructor))
+static void rec_init(void)
+{
+    char *file;
+    char raw[PATH_MAX + 8];
+    struct timespec ts;
+
+    if (real_malloc == NULL)
+	find_real();
+
+    owner = getpid();
+    if ((file = getenv("MMRECORD_FILE")) != NULL && *file)
+	snprintf(path, sizeof(path), "%s", file);
+    else
+	snprintf(path, sizeof(path), "mmrecord-%d.rep", (int)owner);
+    with_threads = getenv("MMRECORD_THREADS") != NULL;
+    with_times = getenv("MMRECORD_TIMES") != NULL;
+
+    snprintf(raw, sizeof(raw), "%s.raw", path);
+    rawfd = open(raw, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (rawfd < 0) {
+	perror(raw);
+	return;
+    }
+    pthread_atfork(NULL, NULL, stop_in_child);
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    t0 = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    recording = 1;
+}
+
+/*******************************
+ * The interposed allocator calls
+ *******************************/
+
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (real_malloc == NULL) {
+	if (finding)
+	    return boot_alloc(size);
+	find_real();
+    }
+    p = real_malloc(size);
+    if (recording && p)
+	record(REC_ALLOC, 0, now(), p, NULL, size);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (real_calloc == NULL) {
+	if (finding)
+	    return boot_alloc(nmemb * size); /* boot[] is already zero */
+	find_real();
+    }
+    p = real_calloc(nmemb, size);
+    if (recording && p)
+	record(REC_ALLOC, 0, now(), p, NULL, nmemb * size);
+    return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    uint64_t start;
+    void *p;
+
+    if (real_realloc == NULL)
+	find_real();
+    if (IS_BOOT(ptr)) {
+	/* boot blocks don't record their size; copy what could be there */
+	if ((p = malloc(size)) != NULL)
+	    memcpy(p, ptr, size < (size_t)(boot + BOOT_BYTES - (char *)ptr) ?
+		   size : (size_t)(boot + BOOT_BYTES - (char *)ptr));
+	return p;
+    }
+    if (!recording)
+	return real_realloc(ptr, size);
+
+    start = now();
+    p = real_realloc(ptr, size);
+    if (ptr == NULL) {
+	if (p)
+	    record(REC_ALLOC, start, now(), p, NULL, size);
+    }
+    else if (p)
+	record(REC_REALLOC, start, now(), p, ptr, size);
+    else if (size == 0) /* realloc freed the block */
+	record(REC_FREE, start, start, NULL, ptr, 0);
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL || IS_BOOT(ptr))
+	return;
+    if (real_free == NULL)
+	find_real();
+    if (recording)
+	record(REC_FREE, now(), 0, NULL, ptr, 0);
+    real_free(ptr);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    void *p;
+
+    if (real_memalign == NULL)
+	find_real();
+    p = real_memalign(alignment, size);
+    if (recording && p)
+	record(REC_ALLOC, 0, now(), p, NULL, size);
+    return p;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    int rc;
+
+    if (real_posix_memalign == NULL)
+	find_real();
+    rc = real_posix_memalign(memptr, alignment, size);
+    if (recording && rc == 0)
+	record(REC_ALLOC, 0, now(), *memptr, NULL, size);
+    return rc;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    void *p;
+
+    if (real_aligned_alloc == NULL)
+	find_real();
+    p = real_aligned_alloc(alignment, size);
+    if (recording && p)
+	record(REC_ALLOC, 0, now(), p, NULL, size);
+    return p;
+}
+
+void *valloc(size_t size)
+{
+    void *p;
+
+    if (real_valloc == NULL)
+	find_real();
+    p = real_valloc(size);
+    if (recording && p)
+	record(REC_ALLOC, 0, now(), p, NULL, size);
+    return p;
+}
+
+void *pvalloc(size_t size)
+{
+    void *p;
+
+    if (real_pvalloc == NULL)
+	find_real();
+    p = real_pvalloc(size);
+    if (recording && p)
+	record(REC_ALLOC, 0, now(), p, NULL, size);
+    return p;
+}
+
+/*********************************************
+ * Turning the recording into a trace at exit
+ *********************************************/
+
+/* A well-mixed hash of a block address */
+#define ADDRHASH(a) ((size_t)(((a) >> 4) * 0x9E3779B97F4A7C15ULL >> 17))
+
+/*
+ * map_init - make an empty address map
+ */
+static int map_init(addrmap_t *m, size_t slots)
+{
+    m->keys = calloc(slots, sizeof(uint64_t));
+    m->ids = malloc(slots * sizeof(int));
+    m->mask = slots - 1;
+    m->live = 0;
+    return (m->keys && m->ids) ? 0 : -1;
+}
+
+/*
+ * map_put - map addr to id, growing the map when it gets half full
+ */
+static int map_put(addrmap_t *m, uint64_t addr, int id)
+{
+    addrmap_t bigger;
+    size_t i;
+
+    if (2 * (m->live + 1) > m->mask + 1) {
+	if (map_init(&bigger, 2 * (m->mask + 1)) < 0)
+	    return -1;
+	for (i = 0; i <= m->mask; i++)
+	    if (m->keys[i])
+		map_put(&bigger, m->keys[i], m->ids[i]);
+	free(m->keys);
+	free(m->ids);
+	*m = bigger;
+    }
+    for (i = ADDRHASH(addr) & m->mask; m->keys[i]; i = (i + 1) & m->mask)
+	if (m->keys[i] == addr)
+	    break;
+    if (!m->keys[i])
+	m->live++;
+    m->keys[i] = addr;
+    m->ids[i] = id;
+    return 0;
+}
+
+/*
+ * map_take - remove addr from the map and return its id, or -1 if it
+ *    isn't there. Later entries of the probe run are shifted back so
+ *    that every entry stays reachable from its home slot.
+ */
+static int map_take(addrmap_t *m, uint64_t addr)
+{
+    size_t i, j, home;
+    int id;
+
+    for (i = ADDRHASH(addr) & m->mask; m->keys[i]; i = (i + 1) & m->mask)
+	if (m->keys[i] == addr)
+	    break;
+    if (!m->keys[i])
+	return -1;
+    id = m->ids[i];
+    for (j = (i + 1) & m->mask; m->keys[j]; j = (j + 1) & m->mask) {
+	home = ADDRHASH(m->keys[j]) & m->mask;
+	if (((j - home) & m->mask) >= ((j - i) & m->mask)) {
+	    m->keys[i] = m->keys[j];
+	    m->ids[i] = m->ids[j];
+	    i = j;
+	}
+    }
+    m->keys[i] = 0;
+    m->live--;
+    return id;
+}
+
+static rec_t *sort_recs; /* the recording, for cmp_points */
+
+/*
+ * cmp_points - order points by time. A thread's own requests stay in
+ *    the order it made them; otherwise blocks given back at the same
+ *    instant come before blocks obtained.
+ */
+static int cmp_points(const void *a, const void *b)
+{
+    const point_t *p = a, *q = b;
+
+    if (p->ns != q->ns)
+	return p->ns < q->ns ? -1 : 1;
+    if (sort_recs[p->rec].tid != sort_recs[q->rec].tid &&
+	p->acquire != q->acquire)
+	return p->acquire ? 1 : -1;
+    if (p->rec != q->rec)
+	return p->rec < q->rec ? -1 : 1;
+    return p->acquire ? 1 : -1; /* a realloc gives back, then obtains */
+}
+
+/*
+ * convert - turn the n requests in recs into the trace at path.
+ *    Returns 0 on success or -1 if memory or the file ran out.
+ */
+static int convert(rec_t *recs, size_t n)
+{
+    point_t *points;
+    traceop_t *ops;
+    int *pending;
+    uint64_t *sizes;
+    size_t i, npoints = 0, nops = 0, nids = 0;
+    uint64_t live = 0, peak = 0;
+    addrmap_t map;
+    rec_t *r;
+    int id;
+    uint32_t tid;
+    FILE *fp, *times = NULL;
+    char timespath[PATH_MAX + 8];
+
+    /* Each request takes effect at one point, a realloc at two */
+    points = malloc(2 * n * sizeof(point_t));
+    pending = malloc(n * sizeof(int));
+    sizes = malloc(n * sizeof(uint64_t));
+    if (!points || !pending || !sizes || map_init(&map, MAP_MIN) < 0)
+	return -1;
+    for (i = 0; i < n; i++) {
+	r = &recs[i];
+	if (r->type != REC_ALLOC) {
+	    points[npoints].ns = r->start;
+	    points[npoints].rec = i;
+	    points[npoints++].acquire = 0;
+	}
+	if (r->type != REC_FREE) {
+	    points[npoints].ns = r->end;
+	    points[npoints].rec = i;
+	    points[npoints++].acquire = 1;
+	}
+    }
+    sort_recs = recs;
+    qsort(points, npoints, sizeof(point_t), cmp_points);
+
+    /* Replay the points, giving out ids by address */
+    if ((ops = malloc((n + 1) * sizeof(traceop_t))) == NULL)
+	return -1;
+    for (i = 0; i < npoints; i++) {
+	r = &recs[points[i].rec];
+	if (!points[i].acquire) {
+	    id = map_take(&map, r->old);
+	    if (r->type == REC_REALLOC) {
+		pending[points[i].rec] = id;
+		continue;
+	    }
+	    if (id < 0) /* not allocated while we were recording */
+		continue;
+	    live -= sizes[id];
+	    ops[nops].type = REC_FREE;
+	}
+	else {
+	    if (r->type == REC_REALLOC && (id = pending[points[i].rec]) >= 0) {
+		live -= sizes[id];
+		ops[nops].type = REC_REALLOC;
+	    }
+	    else {
+		id = nids++;
+		ops[nops].type = REC_ALLOC;
+	    }
+	    if (map_put(&map, r->ptr, id) < 0)
+		return -1;
+	    sizes[id] = r->size ? r->size : 1;
+	    live += sizes[id];
+	    if (live > peak)
+		peak = live;
+	    ops[nops].size = sizes[id];
+	}
+	ops[nops].id = id;
+	ops[nops].tid = r->tid;
+	ops[nops++].ns = points[i].ns;
+    }
+
+    /* Free whatever is still allocated, so the trace is balanced */
+    if ((ops = realloc(ops, (nops + map.live + 1) * sizeof(traceop_t))) == NULL)
+	return -1;
+    for (i = 0; i <= map.mask; i++) {
+	if (map.keys[i]) {
+	    ops[nops].type = REC_FREE;
+	    ops[nops].id = map.ids[i];
+	    ops[nops].tid = 0;
+	    ops[nops].ns = nops ? ops[nops-1].ns : 0;
+	    nops++;
+	}
+    }
+
+    /* Write the trace, and the times of its requests if asked to */
+    if ((fp = fopen(path, "w")) == NULL)
+	return -1;
+    if (with_times) {
+	snprintf(timespath, sizeof(timespath), "%s.times", path);
+	if ((times = fopen(timespath, "w")) == NULL)
+	    return -1;
+    }
+    fprintf(fp, "%llu\n%lu\n%lu\n1\n", (unsigned long long)peak,
+	    (unsigned long)nids, (unsigned long)nops);
+    tid = UINT32_MAX;
+    for (i = 0; i < nops; i++) {
+	if (with_threads && ops[i].tid != tid)
+	    fprintf(fp, "t %u\n", ops[i].tid);
+	tid = ops[i].tid;
+	if (ops[i].type == REC_ALLOC)
+	    fprintf(fp, "a %d %llu\n", ops[i].id, (unsigned long long)ops[i].size);
+	else if (ops[i].type == REC_REALLOC)
+	    fprintf(fp, "r %d %llu\n", ops[i].id, (unsigned long long)ops[i].size);
+	else
+	    fprintf(fp, "f %d\n", ops[i].id);
+	if (times)
+	    fprintf(times, "%llu\n", (unsigned long long)ops[i].ns);
+    }
+    if (times && fclose(times) != 0)
+	return -1;
+    if (fclose(fp) != 0)
+	return -1;
+
+    free(points);
+    free(pending);
+    free(sizes);
+    free(ops);
+    free(map.keys);
+    free(map.ids);
+    return 0;
+}
+
+/*
+ * rec_finish - stop recording at exit, and convert the recording
+ */
+__attribute__((destructor))
+static void rec_finish(void)
+{
+    recbuf_t *b;
+    char raw[PATH_MAX + 8];
+    struct stat st;
+    rec_t *recs;
+    int fd;
+
+    if (!recording || getpid() != owner)
+	return;
+    recording = 0;
+    for (b = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE); b; b = b->next)
+	flush(b);
+    close(rawfd);
+
+    snprintf(raw, sizeof(raw), "%s.raw", path);
+    if ((fd = open(raw, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+	perror(raw);
+	return;
+    }
+    recs = NULL;
+    if (st.st_size > 0 &&
+	(recs = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+	perror(raw);
+	close(fd);
+	return;
+    }
+    close(fd);
+    if (convert(recs, st.st_size / sizeof(rec_t)) < 0) {
+	fprintf(stderr, "mmrecord: could not write %s; the recording is "
+		"in %s\n", path, raw);
+	return;
+    }
+    if (recs)
+	munmap(recs, st.st_size);
+    unlink(raw);
+}
@@ -0,0 +1,150 @@
+/*
+ * perfctr.c - hardware performance counters read with perf_event_open.
+ *             On systems without it, every counter is unavailable.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "perfctr.h"
+
+char *perfctr_names[PERFCTR_NUM] = {
+    "cycles", "instrs", "L1D-miss", "LLC-miss", "dTLB-miss", "br-miss"
+};
+
+#ifdef __linux__
+
+/* perf_event_attr type and config for each counter */
+#define CACHE_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static struct {
+    uint32_t type;
+    uint64_t config;
+} events[PERFCTR_NUM] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+/*
+ * perfctr_open - open every counter that is available to this process,
+ *    counting user-mode events only. Returns the number opened; if
+ *    that is less than PERFCTR_NUM, pc->error says why the last 
+ *    missing one failed.
+ */
+int perfctr_open(perfctr_t *pc)
+{
+    struct perf_event_attr attr;
+    int i, n = 0;
+
+    pc->error = 0;
+    for (i = 0; i < PERFCTR_NUM; i++) {
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[i].type;
+	attr.config = events[i].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | 
+	    PERF_FORMAT_TOTAL_TIME_RUNNING;
+	pc->fd[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	if (pc->fd[i] < 0) {
+	    pc->fd[i] = -1;
+	    pc->error = errno;
+	}
+	else
+	    n++;
+    }
+    return n;
+}
+
+/*
+ * perfctr_start - zero the open counters and start them counting
+ */
+void perfctr_start(perfctr_t *pc)
+{
+    int i;
+
+    for (i = 0; i < PERFCTR_NUM; i++)
+	if (pc->fd[i] >= 0) {
+	    ioctl(pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+	    ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+/*
+ * perfctr_stop - stop the counters and store what each counted since
+ *    perfctr_start in counts, or -1 for the unavailable ones
+ */
+void perfctr_stop(perfctr_t *pc, double counts[PERFCTR_NUM])
+{
+    uint64_t val[3]; /* value, time enabled, time running */
+    int i;
+
+    for (i = 0; i < PERFCTR_NUM; i++)
+	if (pc->fd[i] >= 0)
+	    ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    for (i = 0; i < PERFCTR_NUM; i++) {
+	counts[i] = -1;
+	if (pc->fd[i] < 0 || read(pc->fd[i], val, sizeof(val)) != sizeof(val))
+	    continue;
+	if (val[2] == 0)          /* never got onto the PMU */
+	    continue;
+	counts[i] = (double)val[0];
+	if (val[2] < val[1])      /* multiplexed: scale up */
+	    counts[i] *= (double)val[1] / val[2];
+    }
+}
+
+#else /* !__linux__ */
+
+int perfctr_open(perfctr_t *pc)
+{
+    int i;
+
+    for (i = 0; i < PERFCTR_NUM; i++)
+	pc->fd[i] = -1;
+    pc->error = ENOSYS;
+    return 0;
+}
+
+void perfctr_start(perfctr_t *pc)
+{
+}
+
+void perfctr_stop(perfctr_t *pc, double counts[PERFCTR_NUM])
+{
+    int i;
+
+    for (i = 0; i < PERFCTR_NUM; i++)
+	counts[i] = -1;
+}
+
+#endif /* __linux__ */
+
+/*
+ * perfctr_close - release the counters
+ */
+void perfctr_close(perfctr_t *pc)
+{
+    int i;
+
+    for (i = 0; i < PERFCTR_NUM; i++)
+	if (pc->fd[i] >= 0)
+	    close(pc->fd[i]);
+}
@@ -0,0 +1,33 @@
+/*
+ * perfctr.h - hardware performance counters read with perf_event_open
+ *
+ * Each counter is opened on its own rather than as a group, so the
+ * ones the CPU, the kernel or a virtual machine don't provide are
+ * simply left out. Counts are scaled up if the kernel had to 
+ * multiplex the counters.
+ */
+#ifndef __PERFCTR_H_
+#define __PERFCTR_H_
+
+/* The counters, in the order they are reported */
+#define PERFCTR_CYCLES       0
+#define PERFCTR_INSTRUCTIONS 1
+#define PERFCTR_L1D_MISSES   2
+#define PERFCTR_LLC_MISSES   3
+#define PERFCTR_DTLB_MISSES  4
+#define PERFCTR_BRANCH_MISSES 5
+#define PERFCTR_NUM          6
+
+typedef struct {
+    int fd[PERFCTR_NUM];     /* one per counter, -1 if unavailable */
+    int error;               /* errno from the last counter that failed */
+} perfctr_t;
+
+extern char *perfctr_names[PERFCTR_NUM];
+
+int perfctr_open(perfctr_t *pc);
+void perfctr_start(perfctr_t *pc);
+void perfctr_stop(perfctr_t *pc, double counts[PERFCTR_NUM]);
+void perfctr_close(perfctr_t *pc);
+
+#endif /* __PERFCTR_H_ */
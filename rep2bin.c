@@ -0,0 +1,73 @@
+/*
+ * rep2bin.c - convert a malloc lab trace to the binary trace format
+ *
+ * Reads a trace in either format and writes it as a binary trace
+ * (see tracefile.h), which mdriver recognizes by its magic number.
+ *
+ *     unix> rep2bin traces/amptjp-bal.rep amptjp-bal.bin
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "tracefile.h"
+
+int main(int argc, char **argv)
+{
+    tracefile_t in;
+    tracebin_writer_t out;
+    traceop_t op;
+    int rc;
+
+    if (argc != 3) {
+	fprintf(stderr, "Usage: %s <tracefile> <binary tracefile>\n", argv[0]);
+	exit(1);
+    }
+
+    if (tracefile_open(argv[1], &in) < 0) {
+	fprintf(stderr, "%s\n", in.errmsg);
+	exit(1);
+    }
+    if (tracebin_create(argv[2], &out, in.sugg_heapsize, in.weight) < 0) {
+	perror(argv[2]);
+	exit(1);
+    }
+
+    while ((rc = tracefile_next(&in, &op)) > 0) {
+	if (tracebin_put(&out, &op) < 0) {
+	    if (errno == ERANGE)
+		fprintf(stderr, "%s: id %llu is too big, or too far from the"
+			" one before it, to encode\n", argv[1], 
+			(unsigned long long)op.index);
+	    else
+		perror(argv[2]);
+	    unlink(argv[2]);
+	    exit(1);
+	}
+    }
+    if (rc < 0) {
+	fprintf(stderr, "%s: %s\n", argv[1], in.errmsg);
+	unlink(argv[2]);
+	exit(1);
+    }
+    tracefile_close(&in);
+
+    /* The header counts must agree with what the trace really holds */
+    if (out.hdr.num_ops != in.num_ops || out.hdr.num_ids != in.num_ids) {
+	fprintf(stderr, "%s: header says %llu ids and %llu ops, found %llu and %llu\n",
+		argv[1], (unsigned long long)in.num_ids,
+		(unsigned long long)in.num_ops,
+		(unsigned long long)out.hdr.num_ids,
+		(unsigned long long)out.hdr.num_ops);
+	unlink(argv[2]);
+	exit(1);
+    }
+
+    if (tracebin_finish(&out) < 0) {
+	perror(argv[2]);
+	unlink(argv[2]);
+	exit(1);
+    }
+    exit(0);
+}
@@ -0,0 +1,440 @@
+/*
+ * tracefile.c - read text and binary malloc lab traces, and write
+ *               binary ones. See tracefile.h for the binary format.
+ *
+ * Binary traces are mapped into memory with mmap and decoded in place
+ * straight from the mapping, so loading one costs a single pass over
+ * a few bytes per op instead of a stdio token parse per field. Only a
+ * WINDOW_BYTES window of the file is mapped at a time, sliding along
+ * as the ops are read, so a trace can be far larger than memory or
+ * than a 32-bit address space. The checksum is accumulated as the
+ * windows are mapped and checked when the op stream runs out.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tracefile.h"
+
+/* How much of a binary trace is mapped at a time */
+#define WINDOW_BYTES (16 << 20)
+
+/* The most bytes one op can take: thread switch, tag and size */
+#define MAX_OP_BYTES 64
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME  1099511628211ULL
+
+/* zigzag encoding maps small signed deltas to small unsigned values */
+#define ZIGZAG(d)   (((uint64_t)(d) << 1) ^ (uint64_t)((int64_t)(d) >> 63))
+#define UNZIGZAG(u) ((int64_t)((u) >> 1) ^ -(int64_t)((u) & 1))
+
+/*
+ * fnv1a - fold len bytes at p into the running FNV-1a hash h
+ */
+static uint64_t fnv1a(uint64_t h, unsigned char *p, size_t len)
+{
+    while (len-- > 0) {
+	h ^= *p++;
+	h *= FNV_PRIME;
+    }
+    return h;
+}
+
+/*
+ * get_varint - decode one varint at *pos (not past end) into *val.
+ *    Returns 0 on success, -1 if the varint is truncated or too long.
+ */
+static int get_varint(unsigned char **pos, unsigned char *end, uint64_t *val)
+{
+    unsigned char *p = *pos;
+    uint64_t v = 0;
+    int shift = 0;
+
+    while (p < end && shift < 64) {
+	v |= (uint64_t)(*p & 0x7f) << shift;
+	if ((*p++ & 0x80) == 0) {
+	    *pos = p;
+	    *val = v;
+	    return 0;
+	}
+	shift += 7;
+    }
+    return -1;
+}
+
+/*
+ * put_varint - encode val into buf, returning the number of bytes used
+ */
+static int put_varint(unsigned char *buf, uint64_t val)
+{
+    int n = 0;
+
+    while (val >= 0x80) {
+	buf[n++] = (unsigned char)(val | 0x80);
+	val >>= 7;
+    }
+    buf[n++] = (unsigned char)val;
+    return n;
+}
+
+/*
+ * tracefile_is_binary - return true if the file at path starts with
+ *    the binary trace magic number
+ */
+int tracefile_is_binary(char *path)
+{
+    FILE *fp;
+    char magic[8];
+    int binary = 0;
+
+    if ((fp = fopen(path, "rb")) == NULL)
+	return 0;
+    if (fread(magic, 1, sizeof(magic), fp) == sizeof(magic))
+	binary = !memcmp(magic, TRACEBIN_MAGIC, sizeof(magic));
+    fclose(fp);
+    return binary;
+}
+
+/*
+ * map_window - map the window of a binary trace that starts with the
+ *    byte at file offset off, folding the bytes not yet seen into the
+ *    running checksum. Returns -1 with a message in tf->errmsg if the
+ *    window can't be mapped.
+ */
+static int map_window(tracefile_t *tf, uint64_t off)
+{
+    uint64_t start = off & ~(uint64_t)(sysconf(_SC_PAGESIZE) - 1);
+    size_t len = (tf->data_end - start > WINDOW_BYTES) ? 
+	WINDOW_BYTES : (size_t)(tf->data_end - start);
+
+    if (tf->map)
+	munmap(tf->map, tf->maplen);
+    tf->map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, tf->fd, (off_t)start);
+    if (tf->map == MAP_FAILED) {
+	tf->map = NULL;
+	sprintf(tf->errmsg, "Could not map the binary trace: %s", 
+		strerror(errno));
+	return -1;
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(tf->map, len, MADV_SEQUENTIAL);
+#endif
+    tf->maplen = len;
+    tf->mapoff = start;
+    tf->pos = tf->map + (off - start);
+    tf->end = tf->map + len;
+
+    /* Windows overlap by less than a page; sum each byte once */
+    tf->sum = fnv1a(tf->sum, tf->map + (tf->sum_off - start), 
+		    (size_t)(start + len - tf->sum_off));
+    tf->sum_off = start + len;
+    return 0;
+}
+
+/*
+ * open_binary - open a binary trace, check its header, and map the
+ *    first window of its op stream
+ */
+static int open_binary(char *path, tracefile_t *tf)
+{
+    struct stat st;
+    tracebin_hdr_t hdr;
+
+    if ((tf->fd = open(path, O_RDONLY)) < 0 || fstat(tf->fd, &st) < 0) {
+	sprintf(tf->errmsg, "Could not open %.200s: %s", path, strerror(errno));
+	goto bad;
+    }
+    if ((uint64_t)st.st_size < sizeof(hdr) ||
+	pread(tf->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+	sprintf(tf->errmsg, "Truncated binary trace header");
+	goto bad;
+    }
+    if (hdr.version != TRACEBIN_VERSION) {
+	sprintf(tf->errmsg, "Unsupported binary trace version %u",
+		(unsigned)hdr.version);
+	goto bad;
+    }
+    if (hdr.data_bytes != (uint64_t)st.st_size - sizeof(hdr)) {
+	sprintf(tf->errmsg, "Binary trace is truncated");
+	goto bad;
+    }
+
+    tf->data_end = (uint64_t)st.st_size;
+    tf->checksum = hdr.checksum;
+    tf->sum = FNV_OFFSET;
+    tf->sum_off = sizeof(hdr);
+    if (hdr.data_bytes > 0 && map_window(tf, sizeof(hdr)) < 0)
+	goto bad;
+
+    tf->sugg_heapsize = hdr.sugg_heapsize;
+    tf->num_ids = hdr.num_ids;
+    tf->num_ops = hdr.num_ops;
+    tf->weight = hdr.weight;
+    tf->previndex = 0;
+    tf->num_threads = 1;
+    return 0;
+
+ bad:
+    if (tf->fd >= 0)
+	close(tf->fd);
+    tf->fd = -1;
+    return -1;
+}
+
+/*
+ * tracefile_open - open the trace at path, picking the format from
+ *    its magic number, and read its header. Returns 0 on success or
+ *    -1 with a message in tf->errmsg.
+ */
+int tracefile_open(char *path, tracefile_t *tf)
+{
+    memset(tf, 0, sizeof(*tf));
+    tf->fd = -1;
+    tf->num_threads = 1;
+    if ((tf->binary = tracefile_is_binary(path)))
+	return open_binary(path, tf);
+
+    if ((tf->fp = fopen(path, "r")) == NULL) {
+	sprintf(tf->errmsg, "Could not open %.200s: %s", path, strerror(errno));
+	return -1;
+    }
+    if (fscanf(tf->fp, "%" SCNu64, &tf->sugg_heapsize) != 1 ||
+	fscanf(tf->fp, "%" SCNu64, &tf->num_ids) != 1 ||
+	fscanf(tf->fp, "%" SCNu64, &tf->num_ops) != 1 ||
+	fscanf(tf->fp, "%" SCNu64, &tf->weight) != 1) {
+	sprintf(tf->errmsg, "Bad trace header in %.200s", path);
+	return -1;
+    }
+    return 0;
+}
+
+/*
+ * set_thread - make tid the thread of the ops that follow
+ */
+static int set_thread(tracefile_t *tf, uint64_t tid)
+{
+    if (tid > 0x7fffffff) {
+	sprintf(tf->errmsg, "Bogus thread id %llu", (unsigned long long)tid);
+	return -1;
+    }
+    tf->tid = (int)tid;
+    if (tf->tid >= tf->num_threads)
+	tf->num_threads = tf->tid + 1;
+    return 0;
+}
+
+/*
+ * tracefile_next - read the next op into *op. Returns 1 if there was
+ *    one, 0 at the end of the trace, or -1 with a message in
+ *    tf->errmsg if the trace is malformed.
+ */
+int tracefile_next(tracefile_t *tf, traceop_t *op)
+{
+    char type[256];
+    uint64_t index, size;
+    uint64_t tag, val;
+    int64_t delta;
+
+    if (!tf->binary) {
+ again:
+	if (fscanf(tf->fp, "%255s", type) != 1)
+	    return 0;
+	op->tid = tf->tid;
+	switch (type[0]) {
+	case 'a':
+	case 'r':
+	    if (fscanf(tf->fp, "%" SCNu64 " %" SCNu64, &index, &size) != 2)
+		break;
+	    op->type = (type[0] == 'a') ? ALLOC : REALLOC;
+	    op->index = index;
+	    op->size = size;
+	    return 1;
+	case 'f':
+	    if (fscanf(tf->fp, "%" SCNu64, &index) != 1)
+		break;
+	    op->type = FREE;
+	    op->index = index;
+	    op->size = 0;
+	    return 1;
+	case 'b':
+	    op->type = BARRIER;
+	    op->index = 0;
+	    op->size = 0;
+	    return 1;
+	case 't':
+	    if (fscanf(tf->fp, "%" SCNu64, &index) != 1)
+		break;
+	    if (set_thread(tf, index) < 0)
+		return -1;
+	    goto again;
+	default:
+	    sprintf(tf->errmsg, "Bogus type character (%c)", type[0]);
+	    return -1;
+	}
+	sprintf(tf->errmsg, "Truncated request (%c)", type[0]);
+	return -1;
+    }
+
+    /* Slide the window on before an op could run off its end */
+    if (tf->map && tf->end - tf->pos < MAX_OP_BYTES && 
+	tf->mapoff + tf->maplen < tf->data_end &&
+	map_window(tf, tf->mapoff + (tf->pos - tf->map)) < 0)
+	return -1;
+
+    do {
+	if (tf->pos >= tf->end) {
+	    if (tf->sum != tf->checksum) {
+		sprintf(tf->errmsg, "Binary trace checksum mismatch");
+		return -1;
+	    }
+	    return 0;
+	}
+	if (get_varint(&tf->pos, tf->end, &tag) < 0)
+	    goto corrupt;
+	if (tag == ((TRACEBIN_THREAD << 2) | 3)) {
+	    if (get_varint(&tf->pos, tf->end, &val) < 0 ||
+		set_thread(tf, val) < 0)
+		goto corrupt;
+	}
+    } while (tag == ((TRACEBIN_THREAD << 2) | 3));
+
+    op->tid = tf->tid;
+    if (tag == ((TRACEBIN_BARRIER << 2) | 3)) {
+	op->type = BARRIER;
+	op->index = 0;
+	op->size = 0;
+	return 1;
+    }
+    if ((tag & 3) == 3)
+	goto corrupt;
+    /* Ids are at most INT64_MAX, as tracebin_put writes them */
+    delta = UNZIGZAG(tag >> 2);
+    if (delta < 0 ? (uint64_t)-delta > tf->previndex :
+	(uint64_t)delta > (uint64_t)INT64_MAX - tf->previndex)
+	goto corrupt;
+    op->index = tf->previndex = tf->previndex + (uint64_t)delta;
+    switch (tag & 3) {
+    case 0:
+    case 2:
+	if (get_varint(&tf->pos, tf->end, &val) < 0)
+	    goto corrupt;
+	op->type = ((tag & 3) == 0) ? ALLOC : REALLOC;
+	op->size = val;
+	return 1;
+    case 1:
+	op->type = FREE;
+	op->size = 0;
+	return 1;
+    }
+
+ corrupt:
+    sprintf(tf->errmsg, "Corrupt op at byte %llu of the binary op stream",
+	    (unsigned long long)(tf->mapoff + (tf->pos - tf->map) - 
+				 sizeof(tracebin_hdr_t)));
+    return -1;
+}
+
+/*
+ * tracefile_close - release everything held by an open trace
+ */
+void tracefile_close(tracefile_t *tf)
+{
+    if (tf->fp)
+	fclose(tf->fp);
+    if (tf->map)
+	munmap(tf->map, tf->maplen);
+    if (tf->fd >= 0)
+	close(tf->fd);
+    tf->fp = NULL;
+    tf->map = NULL;
+    tf->fd = -1;
+}
+
+/*
+ * tracebin_create - start writing a binary trace to path. The header
+ *    is filled in by tracebin_finish. Returns -1 on failure.
+ */
+int tracebin_create(char *path, tracebin_writer_t *w,
+		    uint64_t sugg_heapsize, uint64_t weight)
+{
+    memset(w, 0, sizeof(*w));
+    memcpy(w->hdr.magic, TRACEBIN_MAGIC, sizeof(w->hdr.magic));
+    w->hdr.version = TRACEBIN_VERSION;
+    w->hdr.sugg_heapsize = sugg_heapsize;
+    w->hdr.weight = weight;
+    w->hdr.checksum = FNV_OFFSET;
+    if ((w->fp = fopen(path, "wb")) == NULL)
+	return -1;
+    /* Placeholder, rewritten once the counts and checksum are known */
+    if (fwrite(&w->hdr, sizeof(w->hdr), 1, w->fp) != 1)
+	return -1;
+    return 0;
+}
+
+/*
+ * tracebin_put - append one op to a binary trace. Returns -1 on a
+ *    write error, or with errno set to ERANGE if the op's id is over
+ *    INT64_MAX or too far from the previous one for the 62 bits the
+ *    tag has for the delta.
+ */
+int tracebin_put(tracebin_writer_t *w, traceop_t *op)
+{
+    unsigned char buf[40];
+    int n = 0;
+    int64_t delta = (int64_t)(op->index - w->previndex);
+    int code = (op->type == ALLOC) ? 0 : (op->type == FREE) ? 1 : 2;
+
+    /* Switch threads first if this op comes from a different one */
+    if (op->tid != w->tid) {
+	n += put_varint(buf + n, (TRACEBIN_THREAD << 2) | 3);
+	n += put_varint(buf + n, (uint64_t)op->tid);
+	w->tid = op->tid;
+	w->hdr.flags |= TRACEBIN_THREADS;
+    }
+
+    if (op->type == BARRIER) {
+	n += put_varint(buf + n, (TRACEBIN_BARRIER << 2) | 3);
+	w->hdr.flags |= TRACEBIN_THREADS;
+    }
+    else {
+	if (op->index > INT64_MAX || ZIGZAG(delta) >> 62) {
+	    errno = ERANGE;
+	    return -1;
+	}
+	n += put_varint(buf + n, (ZIGZAG(delta) << 2) | code);
+	if (op->type != FREE)
+	    n += put_varint(buf + n, op->size);
+	w->previndex = op->index;
+	if ((op->type != FREE) && op->index >= w->hdr.num_ids)
+	    w->hdr.num_ids = op->index + 1;
+    }
+    if (fwrite(buf, 1, n, w->fp) != (size_t)n)
+	return -1;
+
+    w->hdr.checksum = fnv1a(w->hdr.checksum, buf, n);
+    w->hdr.data_bytes += n;
+    w->hdr.num_ops++;
+    return 0;
+}
+
+/*
+ * tracebin_finish - write the final header and close the trace
+ */
+int tracebin_finish(tracebin_writer_t *w)
+{
+    int ok;
+
+    ok = (fseek(w->fp, 0, SEEK_SET) == 0) &&
+	(fwrite(&w->hdr, sizeof(w->hdr), 1, w->fp) == 1);
+    if (fclose(w->fp) != 0)
+	ok = 0;
+    w->fp = NULL;
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,109 @@
+/*
+ * tracefile.h - reading and writing malloc lab trace files
+ *
+ * A trace is either an ASCII file in the format described in
+ * traces/README, or a binary file laid out as
+ *
+ *     tracebin_hdr_t       fixed-size header, host byte order
+ *     op stream            data_bytes bytes of varint-encoded ops
+ *
+ * Each op in the stream is an unsigned LEB128 varint tag, followed
+ * for allocs and reallocs by a varint byte size. The low two bits of
+ * the tag hold the request type and the rest hold the zigzag-encoded
+ * difference between this request's id and the previous one's, so
+ * the common run of nearby ids costs one or two bytes per op. The
+ * header carries an FNV-1a checksum of the op stream.
+ *
+ * Sizes, ids and the header counts are 64-bit in both formats. Whether
+ * a trace fits in the program reading it (size_t, memory) is for that
+ * program to check.
+ *
+ * Type code 3 marks a record that is not an alloc, free or realloc,
+ * and the rest of its tag says which: TRACEBIN_BARRIER, or
+ * TRACEBIN_THREAD followed by a varint thread id that applies to the
+ * ops after it. Text traces spell these "b" and "t <tid>".
+ */
+#ifndef __TRACEFILE_H_
+#define __TRACEFILE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    enum {ALLOC, FREE, REALLOC, BARRIER} type; /* type of request */
+    int tid;                          /* thread that makes the request */
+    uint64_t index;                   /* index for free() to use later */
+    uint64_t size;                    /* byte size of alloc/realloc request */
+} traceop_t;
+
+/* Header of a binary trace file */
+#define TRACEBIN_MAGIC   "MALLOCTR"
+#define TRACEBIN_VERSION 1
+
+/* Header flags */
+#define TRACEBIN_THREADS 0x1 /* trace has thread ids or barriers */
+
+/* Kinds of type code 3 records */
+#define TRACEBIN_BARRIER 0
+#define TRACEBIN_THREAD  1
+
+typedef struct {
+    char magic[8];           /* TRACEBIN_MAGIC, not NUL-terminated */
+    uint32_t version;        /* TRACEBIN_VERSION */
+    uint32_t flags;          /* TRACEBIN_* flags */
+    uint64_t sugg_heapsize;  /* suggested heap size (unused) */
+    uint64_t num_ids;        /* number of alloc/realloc ids */
+    uint64_t num_ops;        /* number of requests */
+    uint64_t weight;         /* weight for this trace (unused) */
+    uint64_t data_bytes;     /* length of the op stream */
+    uint64_t checksum;       /* FNV-1a hash of the op stream */
+} tracebin_hdr_t;
+
+/* A trace file of either format, opened for reading one op at a time */
+typedef struct {
+    int binary;              /* set if this is a binary trace */
+    uint64_t sugg_heapsize;  /* header values, common to both formats */
+    uint64_t num_ids;
+    uint64_t num_ops;
+    uint64_t weight;
+
+    FILE *fp;                /* text traces: the open file */
+
+    int fd;                  /* binary traces: the open file ... */
+    uint64_t data_end;       /* ... the offset where its op stream ends */
+    unsigned char *map;      /* ... the window of it mapped now ... */
+    size_t maplen;
+    uint64_t mapoff;         /* ... at this (page-aligned) offset ... */
+    unsigned char *pos;      /* ... decode cursor into the window ... */
+    unsigned char *end;      /* ... and its end */
+    uint64_t checksum;       /* the header's checksum of the op stream, */
+    uint64_t sum;            /* the same of the bytes mapped so far, */
+    uint64_t sum_off;        /* which end at this offset */
+    uint64_t previndex;      /* id of the previous op */
+
+    int tid;                 /* thread making the ops being read */
+    int num_threads;         /* 1 + highest thread id read so far */
+
+    char errmsg[256];        /* why the last call failed */
+} tracefile_t;
+
+/* A binary trace being written */
+typedef struct {
+    FILE *fp;
+    tracebin_hdr_t hdr;
+    uint64_t previndex;
+    int tid;                 /* thread of the ops written last */
+} tracebin_writer_t;
+
+int tracefile_is_binary(char *path);
+int tracefile_open(char *path, tracefile_t *tf);
+int tracefile_next(tracefile_t *tf, traceop_t *op);
+void tracefile_close(tracefile_t *tf);
+
+int tracebin_create(char *path, tracebin_writer_t *w,
+		    uint64_t sugg_heapsize, uint64_t weight);
+int tracebin_put(tracebin_writer_t *w, traceop_t *op);
+int tracebin_finish(tracebin_writer_t *w);
+
+#endif /* __TRACEFILE_H_ */
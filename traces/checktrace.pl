@@ -81,6 +81,11 @@ while ($line = <STDIN>) {
     # save the line for output later
     $lines[$requestnum++] = $line;
 
+    # thread switches and barriers don't touch any block
+    if ($cmd eq "t" or $cmd eq "b") {
+	next;
+    }
+
     #ignore realloc requests, as long as they are preceeded by an alloc request
     if ($cmd eq "r") {
 	if (!$HASH{$id}) {
@@ -0,0 +1,474 @@
+/*
+ * tracestat.c - describe the workload in malloc lab traces
+ *
+ * Reads traces of either format and reports what a package has to
+ * cope with in each:
+ *
+ *     - request sizes of allocs and reallocs, by power-of-2 size class
+ *     - block lifetimes, counted in requests from alloc to free
+ *     - peak and average live bytes and live blocks
+ *     - the ratio of new to old size in each realloc
+ *     - reuse within each size class: how many allocs could have been
+ *       served by a block of the same class freed earlier, as a
+ *       segregated fits package would like to
+ *     - phases: the trace cut into equal windows of requests, with a
+ *       mark where the mix of sizes or of allocs and frees shifts
+ *
+ *     unix> tracestat traces/realloc-bal.rep
+ *     unix> tracestat -s traces/amptjp-bal.rep traces/cccp-bal.rep
+ *
+ * -s prints only a one-line summary per trace, to set next to the
+ * per-trace results of mdriver.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "tracefile.h"
+#include "hist.h"
+
+#define NCLASSES    48    /* size classes: (2^(k-1), 2^k] bytes, the last
+			     also holds everything bigger */
+#define NOT_LIVE    UINT64_MAX
+#define DEF_WINDOWS 10    /* phase windows per trace (-w) */
+#define MAX_WINDOWS 1000
+#define PHASE_SHIFT 0.25  /* distance between windows that marks a phase */
+
+/* Realloc growth ratio bins: new size over old size */
+#define NRATIOS 7
+static double ratio_high[NRATIOS] = {1 - 1e-9, 1 + 1e-9, 1.25, 1.5, 2, 4, HUGE_VAL};
+static char *ratio_name[NRATIOS] = {"< 1", "= 1", "<= 1.25", "<= 1.5", "<= 2",
+				    "<= 4", "> 4"};
+
+/* What happened in one window of the trace */
+typedef struct {
+    long ops, allocs, frees, reallocs;
+    double bytes;              /* bytes requested by allocs */
+    long classes[NCLASSES];    /* allocs per size class */
+    long long live_bytes;      /* live at the end of the window */
+    long live;
+} window_t;
+
+/* Everything gathered from one trace */
+typedef struct {
+    char *name;
+    long ops, allocs, frees, reallocs, barriers;
+    uint64_t ids;
+    int threads;
+    hist_t alloc_sizes, realloc_sizes, lifetimes;
+    long alloc_class[NCLASSES], realloc_class[NCLASSES];
+    long never_freed;
+    long long live_bytes, peak_bytes;
+    long live, peak_live;
+    double sum_live_bytes, sum_live; /* summed after each request */
+    long ratio[NRATIOS];
+    double sum_log_ratio;
+    long class_allocs[NCLASSES], class_reused[NCLASSES];
+    long class_pending[NCLASSES];    /* freed, not yet reused */
+    int nwindows;
+    window_t *windows;
+} stats_t;
+
+static void usage(void);
+static void app_error(char *msg);
+
+/*
+ * size_class - the power-of-2 class of a request size
+ */
+static int size_class(uint64_t size)
+{
+    int k = 0;
+
+    while (k < NCLASSES - 1 && (1ULL << k) < size)
+	k++;
+    return k;
+}
+
+/*
+ * class_range - print the byte range of class k into buf
+ */
+static char *class_range(int k, char *buf)
+{
+    if (k == 0)
+	sprintf(buf, "0-1");
+    else if (k == NCLASSES - 1)
+	sprintf(buf, "> %lluG", (1ULL << (k - 1)) >> 30);
+    else if (k > 30)
+	sprintf(buf, "%lluG+1-%lluG", (1ULL << (k - 1)) >> 30, (1ULL << k) >> 30);
+    else
+	sprintf(buf, "%llu-%llu", (1ULL << (k - 1)) + 1, 1ULL << k);
+    return buf;
+}
+
+/*
+ * window_distance - how different two windows look: half the summed
+ *    difference of their size class shares, or the change in the
+ *    share of frees among allocs and frees, whichever is larger
+ */
+static double window_distance(window_t *a, window_t *b)
+{
+    double d = 0, fa, fb;
+    int k;
+
+    if (a->allocs > 0 && b->allocs > 0) {
+	for (k = 0; k < NCLASSES; k++)
+	    d += fabs((double)a->classes[k] / a->allocs -
+		      (double)b->classes[k] / b->allocs);
+	d /= 2;
+    }
+    fa = (a->allocs + a->frees) ? (double)a->frees / (a->allocs + a->frees) : 0;
+    fb = (b->allocs + b->frees) ? (double)b->frees / (b->allocs + b->frees) : 0;
+    return (fabs(fa - fb) > d) ? fabs(fa - fb) : d;
+}
+
+/*
+ * analyze - read the trace at path into *st. Returns -1 with a
+ *    message in errmsg if the trace can't be read or is inconsistent.
+ */
+static int analyze(char *path, int nwindows, stats_t *st, char *errmsg)
+{
+    tracefile_t tf;
+    traceop_t op;
+    uint64_t *size = NULL;     /* per id: current size, or NOT_LIVE */
+    long *born = NULL;         /* per id: request number of its alloc */
+    window_t *w;
+    int k, rc;
+    uint64_t i;
+    double ratio;
+
+    memset(st, 0, sizeof(*st));
+    st->name = path;
+    hist_reset(&st->alloc_sizes);
+    hist_reset(&st->realloc_sizes);
+    hist_reset(&st->lifetimes);
+
+    if (tracefile_open(path, &tf) < 0) {
+	strcpy(errmsg, tf.errmsg);
+	return -1;
+    }
+    if (tf.num_ids >= SIZE_MAX / sizeof(uint64_t) ||
+	(size = malloc((tf.num_ids + 1) * sizeof(uint64_t))) == NULL ||
+	(born = malloc((tf.num_ids + 1) * sizeof(long))) == NULL) {
+	sprintf(errmsg, "Too many ids (%llu) to analyze",
+		(unsigned long long)tf.num_ids);
+	goto bad;
+    }
+    for (i = 0; i < tf.num_ids; i++)
+	size[i] = NOT_LIVE;
+    st->ids = tf.num_ids;
+    st->nwindows = (tf.num_ops < nwindows) ? (tf.num_ops ? tf.num_ops : 1) : nwindows;
+    if ((st->windows = calloc(st->nwindows, sizeof(window_t))) == NULL)
+	app_error("Out of memory for phase windows");
+
+    while ((rc = tracefile_next(&tf, &op)) > 0) {
+	w = &st->windows[(uint64_t)st->ops * st->nwindows /
+			 (tf.num_ops ? tf.num_ops : 1) % st->nwindows];
+	w->ops++;
+	st->ops++;
+	if (op.type != BARRIER && op.index >= tf.num_ids) {
+	    sprintf(errmsg, "Request %ld: id %llu out of range", st->ops,
+		    (unsigned long long)op.index);
+	    goto bad;
+	}
+
+	switch (op.type) {
+	case ALLOC:
+	    if (size[op.index] != NOT_LIVE) {
+		sprintf(errmsg, "Request %ld: allocate with no intervening free", st->ops);
+		goto bad;
+	    }
+	    k = size_class(op.size);
+	    st->allocs++;
+	    w->allocs++;
+	    w->bytes += op.size;
+	    w->classes[k]++;
+	    hist_add(&st->alloc_sizes, op.size);
+	    st->alloc_class[k]++;
+	    st->class_allocs[k]++;
+	    if (st->class_pending[k] > 0) {
+		st->class_pending[k]--;
+		st->class_reused[k]++;
+	    }
+	    size[op.index] = op.size;
+	    born[op.index] = st->ops;
+	    st->live++;
+	    st->live_bytes += op.size;
+	    break;
+
+	case REALLOC:
+	    if (size[op.index] == NOT_LIVE) {
+		sprintf(errmsg, "Request %ld: realloc without previous alloc", st->ops);
+		goto bad;
+	    }
+	    st->reallocs++;
+	    w->reallocs++;
+	    hist_add(&st->realloc_sizes, op.size);
+	    st->realloc_class[size_class(op.size)]++;
+	    ratio = size[op.index] ? (double)op.size / size[op.index] : HUGE_VAL;
+	    for (k = 0; ratio > ratio_high[k]; k++)
+		;
+	    st->ratio[k]++;
+	    if (size[op.index] > 0 && op.size > 0)
+		st->sum_log_ratio += log(ratio);
+	    /* A move to another class frees one block and takes another */
+	    if ((k = size_class(op.size)) != size_class(size[op.index])) {
+		st->class_pending[size_class(size[op.index])]++;
+		st->class_allocs[k]++;
+		if (st->class_pending[k] > 0) {
+		    st->class_pending[k]--;
+		    st->class_reused[k]++;
+		}
+	    }
+	    st->live_bytes += (long long)op.size - (long long)size[op.index];
+	    size[op.index] = op.size;
+	    break;
+
+	case FREE:
+	    if (size[op.index] == NOT_LIVE) {
+		sprintf(errmsg, "Request %ld: freeing a block that isn't live", st->ops);
+		goto bad;
+	    }
+	    st->frees++;
+	    w->frees++;
+	    hist_add(&st->lifetimes, st->ops - born[op.index]);
+	    st->class_pending[size_class(size[op.index])]++;
+	    st->live--;
+	    st->live_bytes -= size[op.index];
+	    size[op.index] = NOT_LIVE;
+	    break;
+
+	default:
+	    st->barriers++;
+	    break;
+	}
+
+	if (st->live_bytes > st->peak_bytes)
+	    st->peak_bytes = st->live_bytes;
+	if (st->live > st->peak_live)
+	    st->peak_live = st->live;
+	st->sum_live_bytes += st->live_bytes;
+	st->sum_live += st->live;
+	w->live_bytes = st->live_bytes;
+	w->live = st->live;
+    }
+    if (rc < 0) {
+	strcpy(errmsg, tf.errmsg);
+	goto bad;
+    }
+    st->never_freed = st->live;
+    st->threads = tf.num_threads;
+    free(size);
+    free(born);
+    tracefile_close(&tf);
+    return 0;
+
+ bad:
+    free(size);
+    free(born);
+    tracefile_close(&tf);
+    return -1;
+}
+
+/*
+ * print_sizes - print a size class table of allocs and reallocs
+ */
+static void print_sizes(stats_t *st)
+{
+    char buf[64];
+    int k, lo = NCLASSES, hi = 0;
+
+    printf("\nRequest sizes (bytes)\n");
+    printf("%-10s%12s%12s%12s%12s%10s\n", "", "p50", "p90", "p99", "max", "count");
+    printf("%-10s%12llu%12llu%12llu%12llu%10ld\n", "alloc",
+	   (unsigned long long)hist_percentile(&st->alloc_sizes, 50),
+	   (unsigned long long)hist_percentile(&st->alloc_sizes, 90),
+	   (unsigned long long)hist_percentile(&st->alloc_sizes, 99),
+	   (unsigned long long)st->alloc_sizes.max, st->allocs);
+    if (st->reallocs > 0)
+	printf("%-10s%12llu%12llu%12llu%12llu%10ld\n", "realloc",
+	       (unsigned long long)hist_percentile(&st->realloc_sizes, 50),
+	       (unsigned long long)hist_percentile(&st->realloc_sizes, 90),
+	       (unsigned long long)hist_percentile(&st->realloc_sizes, 99),
+	       (unsigned long long)st->realloc_sizes.max, st->reallocs);
+
+    for (k = 0; k < NCLASSES; k++)
+	if (st->alloc_class[k] || st->realloc_class[k] || st->class_allocs[k]) {
+	    lo = (k < lo) ? k : lo;
+	    hi = k;
+	}
+    if (lo > hi)
+	return;
+    printf("\n%-20s%10s%7s%10s%7s%10s\n", "size class", "allocs", "%",
+	   "reallocs", "%", "reused");
+    for (k = lo; k <= hi; k++)
+	printf("%-20s%10ld%6.1f%%%10ld%6.1f%%%9.1f%%\n", class_range(k, buf),
+	       st->alloc_class[k],
+	       st->allocs ? 100.0 * st->alloc_class[k] / st->allocs : 0,
+	       st->realloc_class[k],
+	       st->reallocs ? 100.0 * st->realloc_class[k] / st->reallocs : 0,
+	       st->class_allocs[k] ? 100.0 * st->class_reused[k] / st->class_allocs[k] : 0);
+}
+
+/*
+ * print_report - print everything gathered about a trace
+ */
+static void print_report(stats_t *st)
+{
+    long reused = 0, takes = 0;
+    int k, i;
+    window_t *w;
+
+    printf("%s\n", st->name);
+    printf("%ld requests: %ld allocs, %ld reallocs, %ld frees, %ld barriers;"
+	   " %llu ids, %d threads\n", st->ops, st->allocs, st->reallocs,
+	   st->frees, st->barriers, (unsigned long long)st->ids, st->threads);
+
+    print_sizes(st);
+
+    printf("\nLifetimes (requests from alloc to free)\n");
+    if (st->frees > 0)
+	printf("p50 %llu, p90 %llu, p99 %llu, max %llu",
+	       (unsigned long long)hist_percentile(&st->lifetimes, 50),
+	       (unsigned long long)hist_percentile(&st->lifetimes, 90),
+	       (unsigned long long)hist_percentile(&st->lifetimes, 99),
+	       (unsigned long long)st->lifetimes.max);
+    else
+	printf("no blocks freed");
+    printf("; %ld never freed\n", st->never_freed);
+
+    printf("\nLive set\n");
+    printf("peak %lld bytes in %ld blocks; average %.0f bytes in %.0f blocks\n",
+	   st->peak_bytes, st->peak_live,
+	   st->ops ? st->sum_live_bytes / st->ops : 0,
+	   st->ops ? st->sum_live / st->ops : 0);
+
+    if (st->reallocs > 0) {
+	printf("\nRealloc growth (new size / old size)\n");
+	for (k = 0; k < NRATIOS; k++)
+	    printf("%8s", ratio_name[k]);
+	printf("%12s\n", "geo. mean");
+	for (k = 0; k < NRATIOS; k++)
+	    printf("%7.1f%%", 100.0 * st->ratio[k] / st->reallocs);
+	printf("%12.3f\n", exp(st->sum_log_ratio / st->reallocs));
+    }
+
+    for (k = 0; k < NCLASSES; k++) {
+	reused += st->class_reused[k];
+	takes += st->class_allocs[k];
+    }
+    printf("\nReuse: %.1f%% of blocks could take the place of a freed block of"
+	   " their size class\n", takes ? 100.0 * reused / takes : 0);
+
+    printf("\nPhases (%d windows of about %ld requests; * marks a shift)\n",
+	   st->nwindows, st->nwindows ? st->ops / st->nwindows : 0);
+    printf("%6s%10s%10s%10s%10s%12s%10s%4s\n", "window", "allocs", "reallocs",
+	   "frees", "avg size", "live bytes", "live", "");
+    for (i = 0; i < st->nwindows; i++) {
+	w = &st->windows[i];
+	printf("%6d%10ld%10ld%10ld%10.0f%12lld%10ld%4s\n", i, w->allocs,
+	       w->reallocs, w->frees, w->allocs ? w->bytes / w->allocs : 0,
+	       w->live_bytes, w->live,
+	       (i > 0 && window_distance(w - 1, w) > PHASE_SHIFT) ? "*" : "");
+    }
+}
+
+/*
+ * print_summary - print one line about a trace, under a header the
+ *    first time
+ */
+static void print_summary(stats_t *st, int first)
+{
+    long reused = 0, takes = 0, shifts = 0;
+    int k;
+
+    if (first)
+	printf("%-28s%10s%10s%10s%8s%10s%9s%8s%7s\n", "trace", "ops", "peakKB",
+	       "avgKB", "p50 sz", "p50 life", "realloc", "reuse", "phases");
+    for (k = 0; k < NCLASSES; k++) {
+	reused += st->class_reused[k];
+	takes += st->class_allocs[k];
+    }
+    for (k = 1; k < st->nwindows; k++)
+	shifts += window_distance(&st->windows[k - 1], &st->windows[k]) > PHASE_SHIFT;
+    printf("%-28.28s%10ld%10.0f%10.0f%8llu%10llu%8.1f%%%7.1f%%%7ld\n",
+	   st->name, st->ops, st->peak_bytes / 1024.0,
+	   st->ops ? st->sum_live_bytes / st->ops / 1024 : 0,
+	   (unsigned long long)hist_percentile(&st->alloc_sizes, 50),
+	   (unsigned long long)hist_percentile(&st->lifetimes, 50),
+	   st->ops ? 100.0 * st->reallocs / st->ops : 0,
+	   takes ? 100.0 * reused / takes : 0, shifts + 1);
+}
+
+/**************
+ * Main routine
+ **************/
+int main(int argc, char **argv)
+{
+    int c, i;
+    int summary = 0;             /* one line per trace (-s) */
+    int nwindows = DEF_WINDOWS;  /* phase windows (-w) */
+    int errors = 0, reported = 0;
+    char errmsg[1024];
+    stats_t st;
+
+    while ((c = getopt(argc, argv, "hsw:")) != EOF) {
+	switch (c) {
+	case 's':
+	    summary = 1;
+	    break;
+	case 'w':
+	    nwindows = atoi(optarg);
+	    if (nwindows < 1 || nwindows > MAX_WINDOWS)
+		app_error("The number of windows must be between 1 and 1000");
+	    break;
+	case 'h':
+	default:
+	    usage();
+	    exit(c != 'h');
+	}
+    }
+    if (optind == argc) {
+	usage();
+	exit(1);
+    }
+
+    for (i = optind; i < argc; i++) {
+	if (analyze(argv[i], nwindows, &st, errmsg) < 0) {
+	    fprintf(stderr, "%s: %s\n", argv[i], errmsg);
+	    errors++;
+	}
+	else if (summary)
+	    print_summary(&st, reported++ == 0);
+	else {
+	    if (reported++ > 0)
+		printf("\n");
+	    print_report(&st);
+	}
+	free(st.windows);
+    }
+    exit(errors > 0);
+}
+
+/*
+ * usage - print help message
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tracestat [-hs] [-w <n>] <tracefile>...\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h      Print this message.\n");
+    fprintf(stderr, "\t-s      Print a one-line summary per trace.\n");
+    fprintf(stderr, "\t-w <n>  Cut each trace into <n> windows to find phases (default %d).\n",
+	    DEF_WINDOWS);
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg)
+{
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}
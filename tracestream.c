@@ -0,0 +1,135 @@
+/*
+ * tracestream.c - read a trace in fixed-size windows of ops, with a
+ *                 reader thread filling one window while the caller
+ *                 replays the other
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "tracestream.h"
+
+/*
+ * reader - thread that fills the two windows in turn until the trace
+ *    runs out, the trace turns out to be malformed, or the caller stops
+ */
+static void *reader(void *arg)
+{
+    tracestream_t *ts = (tracestream_t *)arg;
+    int b = 0;
+    int n, rc = 1;
+
+    for (;;) {
+	/* Wait for the caller to finish with this window */
+	pthread_mutex_lock(&ts->lock);
+	while (ts->full[b] && !ts->stop)
+	    pthread_cond_wait(&ts->cond, &ts->lock);
+	if (ts->stop) {
+	    pthread_mutex_unlock(&ts->lock);
+	    break;
+	}
+	pthread_mutex_unlock(&ts->lock);
+
+	/* Decode the next window without holding the lock */
+	for (n = 0; n < ts->window; n++)
+	    if ((rc = tracefile_next(&ts->tf, &ts->buf[b][n])) <= 0)
+		break;
+
+	pthread_mutex_lock(&ts->lock);
+	ts->count[b] = n;
+	ts->full[b] = 1;
+	if (rc <= 0) {
+	    ts->done = 1;
+	    ts->error = (rc < 0);
+	}
+	pthread_cond_broadcast(&ts->cond);
+	pthread_mutex_unlock(&ts->lock);
+
+	if (rc <= 0)
+	    break;
+	b ^= 1;
+    }
+    return NULL;
+}
+
+/*
+ * tracestream_open - open the trace at path (either format) and start
+ *    reading it window ops at a time. Returns 0 on success or -1 with
+ *    a message in ts->tf.errmsg.
+ */
+int tracestream_open(char *path, int window, tracestream_t *ts)
+{
+    memset(ts, 0, sizeof(*ts));
+    if (tracefile_open(path, &ts->tf) < 0)
+	return -1;
+
+    ts->window = window;
+    ts->held = -1;
+    if ((ts->buf[0] = malloc(window * sizeof(traceop_t))) == NULL ||
+	(ts->buf[1] = malloc(window * sizeof(traceop_t))) == NULL) {
+	sprintf(ts->tf.errmsg, "Out of memory for trace windows");
+	free(ts->buf[0]);
+	tracefile_close(&ts->tf);
+	return -1;
+    }
+    pthread_mutex_init(&ts->lock, NULL);
+    pthread_cond_init(&ts->cond, NULL);
+    if (pthread_create(&ts->reader, NULL, reader, ts) != 0) {
+	sprintf(ts->tf.errmsg, "Could not start the trace reader thread");
+	free(ts->buf[0]);
+	free(ts->buf[1]);
+	tracefile_close(&ts->tf);
+	return -1;
+    }
+    return 0;
+}
+
+/*
+ * tracestream_next - hand the caller the next window in *ops, giving 
+ *    the previous one back to the reader. Returns the number of ops in
+ *    the window, 0 at the end of the trace, or -1 with a message in
+ *    ts->tf.errmsg if the trace is malformed.
+ */
+int tracestream_next(tracestream_t *ts, traceop_t **ops)
+{
+    int n;
+
+    pthread_mutex_lock(&ts->lock);
+    if (ts->held >= 0) {
+	ts->full[ts->held] = 0;
+	ts->held = -1;
+	pthread_cond_broadcast(&ts->cond);
+    }
+    while (!ts->full[ts->next] && !ts->done)
+	pthread_cond_wait(&ts->cond, &ts->lock);
+
+    if (!ts->full[ts->next] || (n = ts->count[ts->next]) == 0) {
+	n = ts->error ? -1 : 0;
+	pthread_mutex_unlock(&ts->lock);
+	return n;
+    }
+    *ops = ts->buf[ts->next];
+    ts->held = ts->next;
+    ts->next ^= 1;
+    pthread_mutex_unlock(&ts->lock);
+    return n;
+}
+
+/*
+ * tracestream_close - stop the reader and release the stream
+ */
+void tracestream_close(tracestream_t *ts)
+{
+    pthread_mutex_lock(&ts->lock);
+    ts->stop = 1;
+    pthread_cond_broadcast(&ts->cond);
+    pthread_mutex_unlock(&ts->lock);
+    pthread_join(ts->reader, NULL);
+
+    pthread_mutex_destroy(&ts->lock);
+    pthread_cond_destroy(&ts->cond);
+    free(ts->buf[0]);
+    free(ts->buf[1]);
+    tracefile_close(&ts->tf);
+}
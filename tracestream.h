@@ -0,0 +1,38 @@
+/*
+ * tracestream.h - read a trace in fixed-size windows of ops
+ *
+ * A reader thread decodes the next window while the caller replays
+ * the current one, so a trace never has to fit in memory and the
+ * replay rarely waits on the file.
+ */
+#ifndef __TRACESTREAM_H_
+#define __TRACESTREAM_H_
+
+#include <pthread.h>
+
+#include "tracefile.h"
+
+/* Default number of ops per window */
+#define STREAM_WINDOW (1 << 16)
+
+typedef struct {
+    tracefile_t tf;          /* the trace being read; header values */
+    int window;              /* ops per window */
+    traceop_t *buf[2];       /* double buffer of windows... */
+    int count[2];            /* ... how many ops each holds ... */
+    int full[2];             /* ... and whether it is ready to replay */
+    int next;                /* the buffer the caller replays next */
+    int held;                /* the buffer the caller has now, or -1 */
+    int done;                /* reader has hit the end (or an error) */
+    int error;               /* reader hit a malformed trace */
+    int stop;                /* caller asked the reader to quit */
+    pthread_t reader;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} tracestream_t;
+
+int tracestream_open(char *path, int window, tracestream_t *ts);
+int tracestream_next(tracestream_t *ts, traceop_t **ops);
+void tracestream_close(tracestream_t *ts);
+
+#endif /* __TRACESTREAM_H_ */